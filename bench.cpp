@@ -0,0 +1,1044 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cmath>
+#include <coroutine>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <malloc.h>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "chashmap.h"
+
+#define CATCH_CONFIG_MAIN
+#include <catch2/catch.hpp>
+
+// every benchmark prints a markdown table shaped like the ones in
+// benchmark.md. run a single one with e.g. `./bench "[probing]"`.
+
+using bench_clock = std::chrono::steady_clock;
+
+static double microseconds(bench_clock::duration d) {
+  return std::chrono::duration<double, std::micro>(d).count();
+}
+
+static double percentile(std::vector<double> samples, double q) {
+  std::sort(samples.begin(), samples.end());
+  return samples[std::min(samples.size() - 1,
+                          (std::size_t)(q * samples.size()))];
+}
+
+static std::vector<std::uint64_t> random_keys(std::size_t n,
+                                              std::uint64_t seed) {
+  std::mt19937_64 gen(seed);
+  std::vector<std::uint64_t> keys(n);
+  for (auto &key : keys)
+    key = gen();
+  return keys;
+}
+
+struct detached_task {
+  struct promise_type {
+    detached_task get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+// awaited without a scheduler, a get on an unlocked table runs inline, so
+// the latency is the lookup itself and not the launch of a thread
+template <class Map>
+static detached_task timed_gets(Map &map,
+                                const std::vector<std::uint64_t> &keys,
+                                std::size_t lookups,
+                                std::vector<double> &latencies) {
+  for (std::size_t i = 0; i < lookups; ++i) {
+    auto key = keys[(i * 7919) % keys.size()];
+    auto start = bench_clock::now();
+    auto *found = co_await map.async_get(key);
+    latencies.push_back(microseconds(bench_clock::now() - start) * 1000);
+    REQUIRE(found != nullptr);
+  }
+}
+
+template <class Probing>
+static void probing_row(const char *name, float load) {
+  const std::size_t capacity = 1 << 15;
+  const std::size_t lookups = 200000;
+  chashmap<std::uint64_t, std::uint64_t, Probing> map(capacity);
+  map.max_load_factor(std::min(load + 0.01f, 0.99f));
+  auto keys = random_keys((std::size_t)(load * capacity), 411);
+  for (auto key : keys)
+    map.insert(key, key).wait();
+  REQUIRE(map.bucket_count() == capacity);
+
+  auto p = map.probe_stats();
+  p.wait();
+  auto stats = p.get();
+
+  std::vector<double> latencies;
+  latencies.reserve(lookups);
+  timed_gets(map, keys, lookups, latencies);
+
+  std::cout << "| " << name << " | " << std::fixed << std::setprecision(2)
+            << map.load_factor() << " | " << stats.max << " | " << stats.mean
+            << " | " << std::setprecision(0) << percentile(latencies, 0.5)
+            << " | " << percentile(latencies, 0.99) << " | "
+            << percentile(latencies, 0.999) << " |\n";
+}
+
+TEST_CASE("probe length and lookup latency", "[probing]") {
+  std::cout << "| Probing | Load | Max probe | Mean probe | p50 get [ns] "
+               "| p99 get [ns] | p999 get [ns] |\n"
+            << "|:---|---:|---:|---:|---:|---:|---:|\n";
+  for (float load : {0.5f, 0.75f, 0.9f, 0.95f}) {
+    probing_row<linear_probing>("linear", load);
+    probing_row<robin_hood_probing>("robin hood", load);
+  }
+}
+
+// ranks drawn from a zipf distribution over [0, n) with exponent s
+static std::vector<std::uint64_t> zipf_trace(std::size_t n, double s,
+                                             std::size_t length,
+                                             std::uint64_t seed) {
+  std::vector<double> cdf(n);
+  double total = 0;
+  for (std::size_t i = 0; i < n; ++i)
+    cdf[i] = total += 1.0 / std::pow(i + 1, s);
+  std::mt19937_64 gen(seed);
+  std::uniform_real_distribution<double> uniform(0, total);
+  std::vector<std::uint64_t> trace(length);
+  for (auto &key : trace)
+    key = std::lower_bound(cdf.begin(), cdf.end(), uniform(gen)) -
+          cdf.begin();
+  return trace;
+}
+
+TEST_CASE("cache hit ratio on zipfian traces", "[cache]") {
+  const std::size_t keys = 100000;
+  const std::size_t threads = 4;
+  auto trace = zipf_trace(keys, 0.99, 40000, 411);
+  std::cout << "| Capacity | Threads | Hit ratio | Loads | Evictions "
+               "| Throughput [ops/s] |\n"
+            << "|:---|---:|---:|---:|---:|---:|\n";
+  for (std::size_t capacity : {1000, 5000, 20000}) {
+    chcache<std::uint64_t, std::uint64_t> cache(capacity);
+    auto load = [](const std::uint64_t &key) { return key * 2; };
+    std::atomic<std::size_t> wrong = 0;
+    auto start = bench_clock::now();
+    std::vector<std::thread> pool;
+    for (std::size_t t = 0; t < threads; ++t) {
+      pool.emplace_back([&, t] {
+        for (std::size_t i = t; i < trace.size(); i += threads) {
+          auto p = cache.get_or_load(trace[i], load);
+          if (p.get() != trace[i] * 2)
+            ++wrong;
+        }
+      });
+    }
+    for (auto &thread : pool)
+      thread.join();
+    double seconds =
+        std::chrono::duration<double>(bench_clock::now() - start).count();
+    auto stats = cache.stats();
+    REQUIRE(wrong == 0);
+    REQUIRE(cache.size() <= capacity);
+    std::cout << "| " << capacity << " | " << threads << " | " << std::fixed
+              << std::setprecision(3)
+              << (double)stats.hits / (stats.hits + stats.misses) << " | "
+              << stats.loads << " | " << stats.evictions << " | "
+              << std::setprecision(0) << trace.size() / seconds << " |\n";
+  }
+}
+
+// a per-thread run queue. retries are scheduled by whichever thread releases
+// the table lock, and the owning thread sleeps until one arrives
+struct queue_scheduler {
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<std::function<void()>> jobs;
+  std::size_t scheduled = 0;
+  void schedule(std::function<void()> job) {
+    {
+      std::lock_guard lock(mutex);
+      ++scheduled;
+      jobs.push_back(std::move(job));
+    }
+    ready.notify_one();
+  }
+  // runs jobs until one of them sets done
+  void run_until(const bool &done) {
+    while (!done) {
+      std::unique_lock lock(mutex);
+      ready.wait(lock, [&] { return !jobs.empty(); });
+      auto job = std::move(jobs.front());
+      jobs.pop_front();
+      lock.unlock();
+      job();
+    }
+  }
+};
+
+using coroutine_map = chashmap<std::uint64_t, std::uint64_t>;
+
+template <class S>
+static detached_task awaited_ops(coroutine_map &map, S &scheduler,
+                                 std::size_t first, std::size_t ops,
+                                 bool &done) {
+  for (std::size_t i = first; i < first + ops; i += 2) {
+    co_await map.async_insert_or_assign(i % 100000, i, scheduler);
+    co_await map.async_get((i * 7) % 100000, scheduler);
+  }
+  done = true;
+}
+
+TEST_CASE("awaited operations vs futures", "[coroutine]") {
+  const std::size_t ops = 1000000;
+  std::cout << "| API | Threads | Ops | Scheduled jobs | Time [s] "
+               "| Throughput [ops/s] |\n"
+            << "|:---|---:|---:|---:|---:|---:|\n";
+  auto row = [&](const char *name, std::size_t threads,
+                 std::size_t jobs, bench_clock::duration elapsed) {
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    std::cout << "| " << name << " | " << threads << " | " << ops << " | "
+              << jobs << " | " << std::fixed << std::setprecision(2)
+              << seconds << " | " << std::setprecision(0) << ops / seconds
+              << " |\n";
+  };
+  {
+    coroutine_map map;
+    auto start = bench_clock::now();
+    for (std::size_t i = 0; i < ops; i += 2) {
+      map.insert_or_assign(i % 100000, i).wait();
+      map.get((i * 7) % 100000).wait();
+    }
+    row("std::future", 1, 0, bench_clock::now() - start);
+  }
+  {
+    coroutine_map map;
+    inline_scheduler scheduler;
+    bool done = false;
+    auto start = bench_clock::now();
+    awaited_ops(map, scheduler, 0, ops, done);
+    REQUIRE(done);
+    row("co_await", 1, 0, bench_clock::now() - start);
+  }
+  {
+    const std::size_t threads = 4;
+    coroutine_map map;
+    std::atomic<std::size_t> jobs = 0;
+    auto start = bench_clock::now();
+    std::vector<std::thread> pool;
+    for (std::size_t t = 0; t < threads; ++t) {
+      pool.emplace_back([&, t] {
+        queue_scheduler scheduler;
+        bool done = false;
+        awaited_ops(map, scheduler, t * (ops / threads), ops / threads, done);
+        scheduler.run_until(done);
+        jobs += scheduler.scheduled;
+      });
+    }
+    for (auto &thread : pool)
+      thread.join();
+    row("co_await", threads, jobs, bench_clock::now() - start);
+  }
+}
+
+// every key of a partition has the partition as its remainder mod 2
+template <class Route>
+static detached_task partition_ops(Route route, std::uint64_t partition,
+                                   std::size_t ops, bool &done) {
+  for (std::size_t i = 0; i < ops; i += 2) {
+    std::uint64_t key = (i % 200000) * 2 + partition;
+    co_await route(key).async_insert_or_assign(key, i);
+    key = ((i * 7) % 200000) * 2 + partition;
+    co_await route(key).async_get(key);
+  }
+  done = true;
+}
+
+template <class Route>
+static detached_task fill_partition(Route route, std::uint64_t partition) {
+  for (std::uint64_t i = 0; i < 200000; ++i)
+    co_await route(i * 2 + partition).async_insert(i * 2 + partition, 0);
+}
+
+TEST_CASE("numa local and remote shard access", "[numa]") {
+  const std::size_t ops = 1000000;
+  auto topology = numa_topology::simulated(2);
+  std::cout << "| Layout | Nodes | Threads | Access | Throughput [ops/s] |\n"
+            << "|:---|---:|---:|---:|---:|\n";
+  // one thread pinned to each node, the thread on node n works on the
+  // partition local_access ? n : 1 - n
+  auto run = [&](const char *layout, auto route, bool local_access) {
+    // each partition is first filled by a thread on its own node, so the
+    // measured calls only assign and allocate nothing. with the shards sized
+    // up front, nothing resizes either, and all of a shard's memory was
+    // first touched on its node
+    std::vector<std::thread> fillers;
+    for (std::size_t node = 0; node < topology.node_count(); ++node) {
+      fillers.emplace_back([&, node] {
+        topology.pin(node);
+        fill_partition(route, node);
+      });
+    }
+    for (auto &thread : fillers)
+      thread.join();
+    auto start = bench_clock::now();
+    std::vector<std::thread> pool;
+    for (std::size_t node = 0; node < topology.node_count(); ++node) {
+      pool.emplace_back([&, node] {
+        topology.pin(node);
+        bool done = false;
+        partition_ops(route, local_access ? node : 1 - node, ops, done);
+      });
+    }
+    for (auto &thread : pool)
+      thread.join();
+    double seconds =
+        std::chrono::duration<double>(bench_clock::now() - start).count();
+    std::cout << "| " << layout << " | " << topology.node_count() << " | "
+              << pool.size() << " | " << (local_access ? "local" : "remote")
+              << " | " << std::fixed << std::setprecision(0)
+              << pool.size() * ops / seconds << " |\n";
+  };
+  {
+    coroutine_map map;
+    run("chashmap", [&](std::uint64_t) -> coroutine_map & { return map; },
+        true);
+  }
+  for (bool local_access : {true, false}) {
+    // 50k keys per shard stay below the max load factor
+    chshardedmap<std::uint64_t, std::uint64_t> map(
+        4, 1 << 17, [](const std::uint64_t &key) { return key % 2; },
+        topology);
+    run("chshardedmap",
+        [&](std::uint64_t key) -> auto & { return map.shard_for(key); },
+        local_access);
+  }
+}
+
+// large vectors are mmapped by malloc and only show up in hblkhd
+static std::size_t heap_in_use() {
+  auto info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+}
+
+static detached_task fill(coroutine_map &map,
+                          const std::vector<std::uint64_t> &keys) {
+  for (auto key : keys)
+    co_await map.async_insert(key, key);
+}
+
+TEST_CASE("frozen map footprint and lookups", "[frozen]") {
+  const std::size_t n = 1000000;
+  const std::size_t lookups = 10000000;
+  auto keys = random_keys(n, 411);
+
+  std::size_t before = heap_in_use();
+  auto live = std::make_unique<coroutine_map>();
+  fill(*live, keys);
+  std::size_t live_bytes = heap_in_use() - before;
+  before = heap_in_use();
+  auto p = live->freeze();
+  p.wait();
+  auto frozen = p.get();
+  std::size_t frozen_bytes = heap_in_use() - before;
+  REQUIRE(frozen.size() == n);
+
+  std::cout << "| Map | Entries | Heap [MiB] | Bytes per entry "
+               "| Lookups [ops/s] |\n"
+            << "|:---|---:|---:|---:|---:|\n";
+  auto row = [&](const char *name, std::size_t bytes,
+                 bench_clock::duration elapsed) {
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    std::cout << "| " << name << " | " << n << " | " << std::fixed
+              << std::setprecision(1) << bytes / 1048576.0 << " | "
+              << (double)bytes / n << " | " << std::setprecision(0)
+              << lookups / seconds << " |\n";
+  };
+
+  std::uint64_t found = 0;
+  auto start = bench_clock::now();
+  [&]() -> detached_task {
+    for (std::size_t i = 0; i < lookups; ++i)
+      found += *co_await live->async_get(keys[(i * 7919) % n]);
+  }();
+  row("chashmap", live_bytes, bench_clock::now() - start);
+
+  start = bench_clock::now();
+  for (std::size_t i = 0; i < lookups; ++i)
+    found -= *frozen.get(keys[(i * 7919) % n]);
+  row("chfrozenmap", frozen_bytes, bench_clock::now() - start);
+  REQUIRE(found == 0);
+  REQUIRE(frozen.memory_usage() <= frozen_bytes);
+}
+
+template <class Set, class Key>
+static detached_task fill_keys(Set &set, const std::vector<Key> &keys) {
+  for (auto &key : keys)
+    co_await set.async_insert(key);
+}
+
+template <class Key>
+static detached_task fill_flags(chashmap<Key, bool> &map,
+                                const std::vector<Key> &keys) {
+  for (auto &key : keys)
+    co_await map.async_insert(key, true);
+}
+
+static std::vector<std::uint64_t>
+concat(const std::vector<std::uint64_t> &value,
+       const std::vector<std::uint64_t> &values) {
+  auto merged = values;
+  merged.insert(merged.end(), value.begin(), value.end());
+  return merged;
+}
+
+static detached_task
+merge_lists(chashmap<std::uint64_t, std::vector<std::uint64_t>> &map,
+            std::size_t values, std::size_t key_count) {
+  for (std::size_t i = 0; i < values; ++i) {
+    std::vector<std::uint64_t> value(1, i);
+    co_await map.async_merge(i % key_count, std::move(value), concat);
+  }
+}
+
+static detached_task
+append_values(chmultimap<std::uint64_t, std::uint64_t> &multimap,
+              std::size_t values, std::size_t key_count) {
+  for (std::size_t i = 0; i < values; ++i)
+    co_await multimap.async_insert(i % key_count, i);
+}
+
+TEST_CASE("set and multimap against map workarounds", "[multimap]") {
+  std::cout << "| Container | Key | Entries | Bytes per entry "
+               "| Insert throughput [ops/s] |\n"
+            << "|:---|:---|---:|---:|---:|\n";
+  auto row = [](const char *name, const char *key, std::size_t n,
+                std::size_t bytes, bench_clock::duration elapsed) {
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    std::cout << "| " << name << " | " << key << " | " << n << " | "
+              << std::fixed << std::setprecision(1) << (double)bytes / n
+              << " | " << std::setprecision(0) << n / seconds << " |\n";
+  };
+
+  const std::size_t n = 1000000;
+  auto sets = [&](const char *key_name, const auto &keys) {
+    using key_type = typename std::decay_t<decltype(keys)>::value_type;
+    {
+      // the first table built in the process is faster to fill than any
+      // later one, so neither container gets to be first
+      chashmap<key_type, bool> warmup;
+      fill_flags(warmup, keys);
+    }
+    {
+      std::size_t before = heap_in_use();
+      auto start = bench_clock::now();
+      chashmap<key_type, bool> map;
+      fill_flags(map, keys);
+      row("chashmap<K, bool>", key_name, n, heap_in_use() - before,
+          bench_clock::now() - start);
+    }
+    {
+      std::size_t before = heap_in_use();
+      auto start = bench_clock::now();
+      chashset<key_type> set;
+      fill_keys(set, keys);
+      REQUIRE(set.size() == n);
+      row("chashset<K>", key_name, n, heap_in_use() - before,
+          bench_clock::now() - start);
+    }
+  };
+  auto keys = random_keys(n, 411);
+  sets("uint64_t", keys);
+  std::vector<std::uint32_t> narrow(keys.begin(), keys.end());
+  std::sort(narrow.begin(), narrow.end());
+  narrow.erase(std::unique(narrow.begin(), narrow.end()), narrow.end());
+  for (std::uint32_t extra = 0; narrow.size() < n; ++extra)
+    if (!std::binary_search(narrow.begin(), narrow.begin() + n / 2, extra))
+      narrow.push_back(extra);
+  narrow.resize(n);
+  sets("uint32_t", narrow);
+  std::vector<std::string> strings;
+  for (auto key : keys)
+    strings.push_back(std::to_string(key % 1000000000000000ull));
+  sets("15 char string", strings);
+
+  const std::size_t key_count = 2000;
+  const std::size_t values = 400000;
+  {
+    std::size_t before = heap_in_use();
+    chashmap<std::uint64_t, std::vector<std::uint64_t>> map;
+    auto start = bench_clock::now();
+    merge_lists(map, values, key_count);
+    row("chashmap<K, vector<V>>, co_await", "uint64_t", values,
+        heap_in_use() - before, bench_clock::now() - start);
+  }
+  {
+    std::size_t before = heap_in_use();
+    chmultimap<std::uint64_t, std::uint64_t> multimap;
+    auto start = bench_clock::now();
+    append_values(multimap, values, key_count);
+    row("chmultimap<K, V>, co_await", "uint64_t", values,
+        heap_in_use() - before, bench_clock::now() - start);
+  }
+
+  // 4 threads append to 2000 shared keys, each keeping 16 appends in flight.
+  // entries and bytes are per value.
+  const std::size_t threads = 4;
+  auto appends = [&](auto append) {
+    std::vector<std::thread> pool;
+    for (std::size_t t = 0; t < threads; ++t) {
+      pool.emplace_back([&, t] {
+        std::vector<std::function<void()>> pending;
+        for (std::size_t i = t; i < values; i += threads) {
+          pending.push_back(append(i % key_count, i));
+          if (pending.size() == 16) {
+            for (auto &wait : pending)
+              wait();
+            pending.clear();
+          }
+        }
+        for (auto &wait : pending)
+          wait();
+      });
+    }
+    for (auto &thread : pool)
+      thread.join();
+  };
+  {
+    using lists = chashmap<std::uint64_t, std::vector<std::uint64_t>>;
+    std::size_t before = heap_in_use();
+    auto start = bench_clock::now();
+    lists map;
+    appends([&](std::uint64_t key, std::uint64_t value) {
+      auto p = std::make_shared<std::future<std::vector<std::uint64_t> &>>(
+          map.merge(key, {value}, concat));
+      return [p] { p->wait(); };
+    });
+    row("chashmap<K, vector<V>>, futures", "uint64_t", values, heap_in_use() - before,
+        bench_clock::now() - start);
+  }
+  {
+    std::size_t before = heap_in_use();
+    auto start = bench_clock::now();
+    chmultimap<std::uint64_t, std::uint64_t> multimap;
+    appends([&](std::uint64_t key, std::uint64_t value) {
+      auto p = std::make_shared<std::future<void>>(
+          multimap.insert(key, value));
+      return [p] { p->wait(); };
+    });
+    REQUIRE(multimap.count(0).get() == values / key_count);
+    row("chmultimap<K, V>, futures", "uint64_t", values, heap_in_use() - before,
+        bench_clock::now() - start);
+  }
+}
+
+static detached_task merge_keys(coroutine_map &into, const coroutine_map &from) {
+  for (auto &[key, value] : from)
+    co_await into.async_merge(key, value, std::plus<std::uint64_t>());
+}
+
+TEST_CASE("parallel construction and merge_from", "[merge]") {
+  // 32 partial maps over a shared key space, like per-thread partial counts
+  const std::size_t partials = 32;
+  const std::size_t entries = 200000;
+  const std::size_t key_space = 2000000;
+  std::vector<std::pair<std::uint64_t, std::uint64_t>> values;
+  std::vector<coroutine_map> parts;
+  for (std::size_t p = 0; p < partials; ++p) {
+    values.clear();
+    for (auto key : random_keys(entries, p))
+      values.emplace_back(key % key_space, 1);
+    parts.emplace_back(values.begin(), values.end());
+  }
+
+  std::cout << "| Operation | Threads | Entries | Time [s] "
+               "| Throughput [entries/s] |\n"
+            << "|:---|---:|---:|---:|---:|\n";
+  auto row = [](const char *name, std::size_t threads, std::size_t n,
+                bench_clock::duration elapsed) {
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    std::cout << "| " << name << " | " << threads << " | " << n << " | "
+              << std::fixed << std::setprecision(2) << seconds << " | "
+              << std::setprecision(0) << n / seconds << " |\n";
+  };
+
+  std::size_t total = 0;
+  for (auto &part : parts)
+    total += part.size();
+  std::size_t merged_size = 0;
+  {
+    coroutine_map result;
+    auto start = bench_clock::now();
+    for (auto &part : parts)
+      merge_keys(result, part);
+    row("co_await async_merge per key", 1, total,
+        bench_clock::now() - start);
+    merged_size = result.size();
+  }
+  for (std::size_t threads : {1, 4, 16}) {
+    coroutine_map result;
+    auto start = bench_clock::now();
+    for (auto &part : parts)
+      result.merge_from(part, std::plus<std::uint64_t>(), threads).wait();
+    row("merge_from", threads, total, bench_clock::now() - start);
+    REQUIRE(result.size() == merged_size);
+  }
+
+  values.clear();
+  for (auto key : random_keys(1000000, 411))
+    values.emplace_back(key, key);
+  {
+    auto start = bench_clock::now();
+    coroutine_map map;
+    [&]() -> detached_task {
+      for (auto &[key, value] : values)
+        co_await map.async_insert(key, value);
+    }();
+    row("co_await async_insert per key", 1, values.size(),
+        bench_clock::now() - start);
+  }
+  for (std::size_t threads : {1, 4, 16}) {
+    auto start = bench_clock::now();
+    coroutine_map map(values.begin(), values.end(), threads);
+    row("range constructor", threads, values.size(),
+        bench_clock::now() - start);
+    REQUIRE(map.size() == values.size());
+  }
+}
+
+// the same 64 byte strings, with hash caching turned off
+struct uncached_string : std::string {
+  using std::string::string;
+  uncached_string(const std::string &s) : std::string(s) {}
+};
+template <> struct std::hash<uncached_string> {
+  std::size_t operator()(const uncached_string &key) const {
+    return std::hash<std::string>()(key);
+  }
+};
+template <> struct cache_hash<uncached_string> : std::false_type {};
+
+template <class Map, class Key>
+static detached_task insert_all(Map &map, const std::vector<Key> &keys) {
+  for (auto &key : keys)
+    co_await map.async_insert(key, 1);
+}
+
+template <class Map, class Key>
+static detached_task get_all(Map &map, const std::vector<Key> &keys,
+                             std::size_t lookups, std::size_t &found) {
+  for (std::size_t i = 0; i < lookups; ++i)
+    found += co_await map.async_get(keys[(i * 7919) % keys.size()]) != nullptr;
+}
+
+template <class Key>
+static void hash_cache_row(const char *name,
+                           const std::vector<std::string> &strings,
+                           const std::vector<std::string> &absent) {
+  const std::size_t lookups = 4000000;
+  std::vector<Key> keys(strings.begin(), strings.end());
+  std::vector<Key> misses(absent.begin(), absent.end());
+  chashmap<Key, int, robin_hood_probing> map;
+  std::size_t before = heap_in_use();
+  insert_all(map, keys);
+  std::size_t bytes = heap_in_use() - before;
+
+  auto start = bench_clock::now();
+  map.reserve(map.bucket_count() * 2);
+  auto resize = bench_clock::now() - start;
+
+  std::size_t found = 0;
+  start = bench_clock::now();
+  get_all(map, keys, lookups, found);
+  auto hits = bench_clock::now() - start;
+  start = bench_clock::now();
+  get_all(map, misses, lookups, found);
+  auto missed = bench_clock::now() - start;
+  REQUIRE(found == lookups);
+
+  auto rate = [&](bench_clock::duration d) {
+    return lookups / std::chrono::duration<double>(d).count();
+  };
+  std::cout << "| " << name << " | " << keys.size() << " | " << std::fixed
+            << std::setprecision(1) << (double)bytes / keys.size() << " | "
+            << std::chrono::duration<double, std::milli>(resize).count()
+            << " | " << std::setprecision(0) << rate(hits) << " | "
+            << rate(missed) << " |\n";
+}
+
+TEST_CASE("hash caching with 64 byte string keys", "[hashcache]") {
+  const std::size_t n = 500000;
+  // keys share a long prefix, like paths or urls, so comparing two of them
+  // reads most of both strings
+  auto strings = [](std::size_t n, std::uint64_t seed) {
+    std::vector<std::string> result;
+    for (auto key : random_keys(n, seed)) {
+      std::string s(64, '/');
+      auto digits = std::to_string(key);
+      s.replace(64 - digits.size(), digits.size(), digits);
+      result.push_back(std::move(s));
+    }
+    return result;
+  };
+  auto present = strings(n, 411);
+  auto absent = strings(n, 412);
+  std::cout << "| Hashes | Entries | Bytes per entry | Resize [ms] "
+               "| Hits [ops/s] | Misses [ops/s] |\n"
+            << "|:---|---:|---:|---:|---:|---:|\n";
+  hash_cache_row<uncached_string>("recomputed", present, absent);
+  hash_cache_row<std::string>("cached", present, absent);
+}
+
+
+// freed chunks sitting in malloc's caches still count as in use for
+// mallinfo2, so short lived maps are measured by counting allocations
+static std::atomic<std::size_t> allocations{0};
+
+[[gnu::noinline]] void *operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size))
+    return p;
+  throw std::bad_alloc();
+}
+[[gnu::noinline]] void operator delete(void *p) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void *p, std::size_t) noexcept {
+  std::free(p);
+}
+
+template <class Map>
+static detached_task small_cycles(const std::vector<std::string> &keys,
+                                  std::size_t cycles) {
+  for (std::size_t c = 0; c < cycles; ++c) {
+    Map map;
+    for (std::size_t i = 0; i < 4; ++i)
+      co_await map.async_insert(keys[(c + i) % keys.size()], (int)i);
+  }
+}
+
+template <class Map> static void small_map_row(const char *name) {
+  const std::size_t cycles = 2000000;
+  std::vector<std::string> keys;
+  for (int i = 0; i < 64; ++i)
+    keys.push_back("attr" + std::to_string(i));
+  small_cycles<Map>(keys, cycles / 10);
+  std::size_t before = allocations;
+  auto start = bench_clock::now();
+  small_cycles<Map>(keys, cycles);
+  auto elapsed = bench_clock::now() - start;
+  std::cout << "| " << name << " | " << sizeof(Map) << " | " << std::fixed
+            << std::setprecision(1) << (double)(allocations - before) / cycles
+            << " | " << std::setprecision(0)
+            << cycles / std::chrono::duration<double>(elapsed).count()
+            << " |\n";
+}
+
+TEST_CASE("construct, insert 4 and destroy small maps", "[small]") {
+  std::cout << "| Map | sizeof | Allocations per cycle | Cycles/s |\n"
+            << "|:---|---:|---:|---:|\n";
+  small_map_row<chashmap<std::string, int>>("default");
+  small_map_row<chashmap<std::string, int, linear_probing, 4>>("Inline = 4");
+  small_map_row<chashmap<std::string, int, linear_probing, 8>>("Inline = 8");
+}
+
+// hashes like std::hash<std::uint64_t> does, ignoring the table's seed
+struct identity_key {
+  std::uint64_t value;
+  bool operator==(const identity_key &) const = default;
+};
+template <> struct std::hash<identity_key> {
+  std::size_t operator()(const identity_key &key) const { return key.value; }
+};
+template <> struct seeded_hash<identity_key> {
+  std::uint64_t operator()(const identity_key &key, std::uint64_t) const {
+    return key.value;
+  }
+};
+
+template <class Key>
+static void hashdos_row(const char *hash, const char *keys_name,
+                        const std::vector<std::uint64_t> &values,
+                        std::size_t buckets) {
+  std::vector<Key> keys;
+  for (auto value : values)
+    keys.push_back(Key{value});
+  chashmap<Key, int> map;
+  map.reserve(values.size());
+  REQUIRE(map.bucket_count() == buckets);
+  auto start = bench_clock::now();
+  insert_all(map, keys);
+  auto inserted = bench_clock::now() - start;
+  std::size_t found = 0;
+  start = bench_clock::now();
+  get_all(map, keys, keys.size(), found);
+  auto looked_up = bench_clock::now() - start;
+  REQUIRE(found == keys.size());
+  auto rate = [&](bench_clock::duration d) {
+    return keys.size() / std::chrono::duration<double>(d).count();
+  };
+  std::cout << "| " << hash << " | " << keys_name << " | "
+            << map.probe_stats().get().max << " | " << std::fixed
+            << std::setprecision(0) << rate(inserted) << " | "
+            << rate(looked_up) << " |\n";
+}
+
+TEST_CASE("adversarial and random integer keys", "[hashdos]") {
+  const std::size_t n = 20000;
+  chashmap<std::uint64_t, int> sizing;
+  sizing.reserve(n);
+  const std::size_t buckets = sizing.bucket_count();
+  // every key is a multiple of the bucket count, so they all share the home
+  // bucket 0 under the identity hash
+  std::vector<std::uint64_t> adversarial;
+  for (std::uint64_t i = 0; i < n; ++i)
+    adversarial.push_back(i * buckets);
+  auto random = random_keys(n, 36);
+  std::cout << "| Hash | Keys | Max probe | Inserts [ops/s] | Gets [ops/s] |\n"
+            << "|:---|:---|---:|---:|---:|\n";
+  hashdos_row<identity_key>("identity", "random", random, buckets);
+  hashdos_row<identity_key>("identity", "adversarial", adversarial, buckets);
+  hashdos_row<std::uint64_t>("seeded", "random", random, buckets);
+  hashdos_row<std::uint64_t>("seeded", "adversarial", adversarial, buckets);
+}
+
+// resident set size from /proc/self/statm, in bytes
+static std::size_t resident_bytes() {
+  std::ifstream statm("/proc/self/statm");
+  std::size_t size = 0, resident = 0;
+  statm >> size >> resident;
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+static detached_task erase_keys(coroutine_map &map,
+                                const std::vector<std::uint64_t> &keys,
+                                std::size_t first, std::size_t last) {
+  for (std::size_t i = first; i < last; ++i)
+    co_await map.async_erase(keys[i]);
+}
+
+static void shrink_row(const char *name, auto drain) {
+  const std::size_t n = 2000000;
+  auto keys = random_keys(n, 37);
+  malloc_trim(0);
+  const std::size_t baseline = resident_bytes();
+  auto mib = [&](std::size_t bytes) {
+    return ((double)bytes - baseline) / (1 << 20);
+  };
+  coroutine_map map;
+  fill(map, keys);
+  const std::size_t grown = resident_bytes();
+  auto start = bench_clock::now();
+  drain(map, keys);
+  auto elapsed = bench_clock::now() - start;
+  const std::size_t drained = resident_bytes();
+  malloc_trim(0);
+  const std::size_t trimmed = resident_bytes();
+  std::cout << "| " << name << " | " << map.size() << " | "
+            << map.bucket_count() << " | " << std::fixed
+            << std::setprecision(1) << mib(grown) << " | " << mib(drained)
+            << " | " << mib(trimmed) << " | "
+            << std::chrono::duration<double, std::milli>(elapsed).count()
+            << " |\n";
+}
+
+TEST_CASE("resident memory through grow and drain", "[shrink]") {
+  // fill 2M entries, then erase all but 1%
+  auto erase_most = [](coroutine_map &map, auto &keys) {
+    erase_keys(map, keys, 0, keys.size() - keys.size() / 100);
+  };
+  std::cout << "| Drain | Entries left | Buckets | Grown [MiB] "
+               "| Drained [MiB] | After malloc_trim [MiB] | Drain [ms] |\n"
+            << "|:---|---:|---:|---:|---:|---:|---:|\n";
+  shrink_row("erase", erase_most);
+  shrink_row("erase, min load 0.1", [&](coroutine_map &map, auto &keys) {
+    map.min_load_factor(0.1);
+    erase_most(map, keys);
+  });
+  shrink_row("erase, shrink_to_fit", [&](coroutine_map &map, auto &keys) {
+    erase_most(map, keys);
+    map.shrink_to_fit();
+  });
+  shrink_row("clear()", [](coroutine_map &map, auto &) { map.clear(); });
+  shrink_row("clear(true)",
+             [](coroutine_map &map, auto &) { map.clear(true); });
+}
+
+// writes keys into a fresh map, with a consumer draining log on its own
+// thread when there is one, and reports writes per second
+static void change_log_row(const char *name,
+                           const std::vector<std::uint64_t> &keys,
+                           std::size_t capacity, backpressure policy,
+                           bool consume) {
+  coroutine_map map;
+  std::shared_ptr<chchangelog<std::uint64_t, std::uint64_t>> log;
+  if (capacity != 0)
+    log = map.enable_change_log(capacity, policy);
+  std::atomic<bool> done{false};
+  std::size_t drained = 0;
+  std::thread consumer;
+  if (consume)
+    consumer = std::thread([&] {
+      std::vector<chchangelog<std::uint64_t, std::uint64_t>::change> batch;
+      batch.reserve(1024);
+      // one more pass after the writer is done picks up the rest
+      for (bool last = false; !last;) {
+        last = done.load();
+        batch.clear();
+        while (log->drain(batch, 1024) != 0) {
+          drained += batch.size();
+          batch.clear();
+        }
+        std::this_thread::yield();
+      }
+    });
+  auto start = bench_clock::now();
+  fill(map, keys);
+  auto elapsed = bench_clock::now() - start;
+  done = true;
+  if (consume)
+    consumer.join();
+  std::cout << "| " << name << " | " << std::fixed << std::setprecision(2)
+            << keys.size() / std::chrono::duration<double>(elapsed).count() /
+                   1e6
+            << " | " << drained << " | " << (log ? log->dropped() : 0)
+            << " |\n";
+}
+
+TEST_CASE("write throughput with a change log and drain rate",
+          "[changelog]") {
+  const std::size_t n = 1000000;
+  auto keys = random_keys(n, 91);
+  std::cout << "| Change log | Writes [M/s] | Drained | Dropped |\n"
+            << "|:---|---:|---:|---:|\n";
+  change_log_row("disabled", keys, 0, backpressure::block, false);
+  change_log_row("4096, block, consumer", keys, 4096, backpressure::block,
+                 true);
+  change_log_row("4096, drop, consumer", keys, 4096, backpressure::drop,
+                 true);
+  change_log_row("4096, drop, no consumer", keys, 4096, backpressure::drop,
+                 false);
+  change_log_row("1M, drop, no consumer", keys, 1 << 20, backpressure::drop,
+                 false);
+
+  // what a full snapshot diff costs instead: one count_if over the map
+  coroutine_map mirror;
+  fill(mirror, keys);
+  auto start = bench_clock::now();
+  auto same = mirror.count_if([](auto &, auto &) { return true; }).get();
+  auto scan = bench_clock::now() - start;
+  REQUIRE(same == n);
+
+  std::cout << "\n| Drain batch | Changes drained [M/s] |\n"
+            << "|:---|---:|\n";
+  for (std::size_t batch_size : {1, 64, 1024, 1 << 20}) {
+    coroutine_map map;
+    auto log = map.enable_change_log(1 << 20, backpressure::drop);
+    fill(map, keys);
+    std::vector<chchangelog<std::uint64_t, std::uint64_t>::change> batch;
+    batch.reserve(std::min<std::size_t>(batch_size, n));
+    std::size_t drained = 0;
+    auto start = bench_clock::now();
+    while (drained < n) {
+      batch.clear();
+      drained += log->drain(batch, batch_size);
+    }
+    auto elapsed = bench_clock::now() - start;
+    std::cout << "| " << batch_size << " | " << std::fixed
+              << std::setprecision(2)
+              << n / std::chrono::duration<double>(elapsed).count() / 1e6
+              << " |\n";
+  }
+  std::cout << "\nfull count_if over " << n << " entries: " << std::fixed
+            << std::setprecision(1)
+            << std::chrono::duration<double, std::milli>(scan).count()
+            << " ms\n";
+}
+
+static constexpr std::string_view header_names[] = {
+    "accept",           "accept-encoding",   "accept-language",
+    "authorization",    "cache-control",     "connection",
+    "content-encoding", "content-length",    "content-type",
+    "cookie",           "date",              "etag",
+    "expect",           "forwarded",         "host",
+    "if-match",         "if-modified-since", "if-none-match",
+    "if-range",         "keep-alive",        "last-modified",
+    "location",         "origin",            "pragma",
+    "range",            "referer",           "retry-after",
+    "server",           "set-cookie",        "transfer-encoding",
+    "upgrade",          "user-agent",
+};
+static constexpr std::size_t header_count = std::size(header_names);
+
+static constexpr auto static_headers =
+    []<std::size_t... I>(std::index_sequence<I...>) {
+      return chstaticmap<std::string_view, int, header_count>(
+          {{header_names[I], (int)I}...});
+    }(std::make_index_sequence<header_count>());
+
+template <class Map>
+static void static_lookup_row(const char *name, const Map &map,
+                              const std::vector<std::string_view> &keys,
+                              double build) {
+  const std::size_t lookups = 10000000;
+  std::size_t found = 0;
+  auto start = bench_clock::now();
+  for (std::size_t i = 0; i < lookups; ++i)
+    found += map.get(keys[(i * 7919) % keys.size()]) != nullptr;
+  auto elapsed = bench_clock::now() - start;
+  REQUIRE(found == lookups / 2);
+  std::cout << "| " << name << " | " << std::fixed << std::setprecision(1)
+            << build << " | " << std::setprecision(0)
+            << lookups / std::chrono::duration<double>(elapsed).count()
+            << " |\n";
+}
+
+TEST_CASE("static map lookups against the runtime maps", "[static]") {
+  // every header name, and as many names that aren't in the map
+  std::vector<std::string_view> keys(std::begin(header_names),
+                                     std::end(header_names));
+  std::vector<std::string> absent;
+  for (auto name : header_names)
+    absent.push_back("x-" + std::string(name));
+  keys.insert(keys.end(), absent.begin(), absent.end());
+
+  auto start = bench_clock::now();
+  chashmap<std::string_view, int> live;
+  for (std::size_t i = 0; i < header_count; ++i)
+    live.insert(header_names[i], (int)i).wait();
+  const double built = microseconds(bench_clock::now() - start);
+  start = bench_clock::now();
+  auto frozen = live.freeze().get();
+  const double froze = microseconds(bench_clock::now() - start);
+
+  std::cout << "| Map | Startup [us] | Lookups [ops/s] |\n"
+            << "|:---|---:|---:|\n";
+  // chashmap has no blocking lookup that skips std::async, so its row goes
+  // through co_await async_get, which completes inline
+  const std::size_t lookups = 10000000;
+  std::size_t found = 0;
+  start = bench_clock::now();
+  get_all(live, keys, lookups, found);
+  auto elapsed = bench_clock::now() - start;
+  REQUIRE(found == lookups / 2);
+  std::cout << "| chashmap, co_await async_get | " << std::fixed
+            << std::setprecision(1) << built << " | " << std::setprecision(0)
+            << lookups / std::chrono::duration<double>(elapsed).count()
+            << " |\n";
+  static_lookup_row("chfrozenmap", frozen, keys, built + froze);
+  static_lookup_row("chstaticmap", static_headers, keys, 0);
+}
@@ -1,44 +1,485 @@
 #ifndef CHASHMAP_H
 #define CHASHMAP_H
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <bitset>
+#include <chrono>
 #include <cmath>
 #include <compare>
 #include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <coroutine>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <future>
 #include <initializer_list>
 #include <iostream>
 #include <iterator>
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <random>
+#include <shared_mutex>
 #include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
 #include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// thread sanitizer doesn't support fences
+#if defined(__SANITIZE_THREAD__)
+#define CHASHMAP_NO_FENCES
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define CHASHMAP_NO_FENCES
+#endif
+#endif
 
 template <class Key>
 concept Hashable = requires(Key k) {
   std::hash<Key>()(k);
 };
 
-template <Hashable Key, class T> class chashmap {
+// linear probing with lazy deletion: erased entries stay behind as tombstones
+// until the next resize and are reused by later insertions.
+struct linear_probing {};
+
+// robin hood hashing: an inserted entry takes the slot of any resident that
+// sits closer to its own home bucket, which keeps every probe length close to
+// the mean. erasing shifts the rest of the run back by one slot instead of
+// leaving a tombstone, so a lookup can give up as soon as it passes a resident
+// that is closer to home than the key it is looking for.
+struct robin_hood_probing {};
+
+template <class P>
+concept ProbingPolicy =
+    std::same_as<P, linear_probing> || std::same_as<P, robin_hood_probing>;
+
+// an awaited operation that finds the table locked suspends until the lock is
+// released, and is then retried as a job on the scheduler; the awaiting
+// coroutine resumes from that job. jobs are scheduled from the thread that
+// releases the lock.
+template <class S>
+concept Scheduler = requires(S &s, std::function<void()> job) {
+  s.schedule(std::move(job));
+};
+
+// awaiting without a scheduler blocks the awaiting thread on contention
+// instead of suspending.
+struct inline_scheduler {
+  void schedule(std::function<void()> job) { job(); }
+};
+
+// the lock of a table: a shared_mutex that also keeps the awaited operations
+// waiting for it. every release hands the parked ones back to their
+// schedulers, so a suspended operation is retried once per release instead of
+// over and over. a release that finds nothing parked costs a fence and a
+// load of the waiter list, which only changes when an operation parks.
+class table_mutex {
+public:
+  table_mutex() = default;
+  ~table_mutex();
+  void lock();
+  bool try_lock();
+  void unlock();
+  void lock_shared();
+  bool try_lock_shared();
+  void unlock_shared();
+  // calls wake from the next release. if the lock, shared or exclusive, can
+  // be taken once wake would be registered, returns false instead and
+  // doesn't park.
+  bool park(std::function<void()> wake, bool shared);
+  // runs work on this thread once it next releases a table lock exclusively,
+  // for work that mustn't wait while holding one. writers queue it, and none
+  // of them holds a second table lock exclusively.
+  static void after_unlock(std::function<void()> work);
+
+private:
+  // allocated by the first operation that parks, so a table only used through
+  // futures or blocking calls carries a null pointer instead
+  struct waiter_list {
+    std::mutex mutex;
+    // waiters.size(), plus one while an operation is about to park
+    std::atomic<std::size_t> parked{0};
+    std::vector<std::function<void()>> waiters;
+  };
+
+  std::shared_mutex mutex;
+  std::atomic<waiter_list *> list{nullptr};
+  static inline thread_local std::vector<std::function<void()>> deferred;
+
+  waiter_list &waiting();
+  // store parked before probing the lock, and load it after releasing it.
+  // either the release sees the store, or the probe sees the release
+  void announce(waiter_list &waiting, std::size_t count);
+  waiter_list *anyone_parked();
+  void wake_parked();
+};
+
+inline table_mutex::~table_mutex() {
+  delete list.load(std::memory_order_relaxed);
+}
+
+inline void table_mutex::lock() { mutex.lock(); }
+
+inline bool table_mutex::try_lock() { return mutex.try_lock(); }
+
+inline void table_mutex::unlock() {
+  mutex.unlock();
+  wake_parked();
+  if (!deferred.empty())
+    for (auto &work : std::exchange(deferred, {}))
+      work();
+}
+
+inline void table_mutex::lock_shared() { mutex.lock_shared(); }
+
+inline bool table_mutex::try_lock_shared() { return mutex.try_lock_shared(); }
+
+inline void table_mutex::unlock_shared() {
+  mutex.unlock_shared();
+  wake_parked();
+}
+
+inline void table_mutex::after_unlock(std::function<void()> work) {
+  deferred.push_back(std::move(work));
+}
+
+inline table_mutex::waiter_list &table_mutex::waiting() {
+  waiter_list *current = list.load(std::memory_order_acquire);
+  if (current != nullptr)
+    return *current;
+  auto created = std::make_unique<waiter_list>();
+  if (list.compare_exchange_strong(current, created.get()))
+    return *created.release();
+  return *current;
+}
+
+inline bool table_mutex::park(std::function<void()> wake, bool shared) {
+  waiter_list &waiting = this->waiting();
+  std::lock_guard lock(waiting.mutex);
+  announce(waiting, waiting.waiters.size() + 1);
+  // the probe isn't a release of its own, nobody parked can be waiting for a
+  // lock that is free
+  if (shared ? mutex.try_lock_shared() : mutex.try_lock()) {
+    if (shared)
+      mutex.unlock_shared();
+    else
+      mutex.unlock();
+    waiting.parked.store(waiting.waiters.size(), std::memory_order_relaxed);
+    return false;
+  }
+  waiting.waiters.push_back(std::move(wake));
+  return true;
+}
+
+inline void table_mutex::announce(waiter_list &waiting, std::size_t count) {
+#ifdef CHASHMAP_NO_FENCES
+  // read-modify-writes on parked order the same as the fences, but cost
+  // every release an atomic increment
+  waiting.parked.exchange(count);
+#else
+  waiting.parked.store(count, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+}
+
+inline table_mutex::waiter_list *table_mutex::anyone_parked() {
+#ifdef CHASHMAP_NO_FENCES
+  // the list is published by a read-modify-write too, so a release that
+  // finds it null comes before the first park's probe
+  waiter_list *waiting = list.fetch_add(0);
+  if (waiting == nullptr || waiting->parked.fetch_add(0) == 0)
+    return nullptr;
+#else
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  waiter_list *waiting = list.load(std::memory_order_relaxed);
+  if (waiting == nullptr ||
+      waiting->parked.load(std::memory_order_relaxed) == 0)
+    return nullptr;
+#endif
+  return waiting;
+}
+
+inline void table_mutex::wake_parked() {
+  waiter_list *waiting = anyone_parked();
+  if (waiting == nullptr)
+    return;
+  std::vector<std::function<void()>> woken;
+  {
+    std::lock_guard lock(waiting->mutex);
+    woken.swap(waiting->waiters);
+    waiting->parked.store(0, std::memory_order_relaxed);
+  }
+  for (auto &wake : woken)
+    wake();
+}
+
+// whether every entry stores its key's full hash, so that resizing never
+// hashes a key again and a probe only compares keys whose hashes match.
+// like libstdc++, hashes are cached unless the key is cheap to hash;
+// specialize this for a key type to decide otherwise.
+template <class Key>
+struct cache_hash
+    : std::bool_constant<!std::is_arithmetic_v<Key> &&
+                         !std::is_enum_v<Key> && !std::is_pointer_v<Key>> {};
+
+template <class Key>
+inline constexpr bool cache_hash_v = cache_hash<Key>::value;
+
+namespace hash_detail {
+__extension__ using uint128 = unsigned __int128;
+
+inline constexpr std::uint64_t secret[4] = {
+    0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull,
+    0x4d5a2da51de1aa47ull};
+
+// the 128 bit product of a and b, folded to 64 bits
+constexpr std::uint64_t mix(std::uint64_t a, std::uint64_t b) {
+  const uint128 product = (uint128)a * b;
+  return (std::uint64_t)product ^ (std::uint64_t)(product >> 64);
+}
+
+// little endian loads, spelled out so they work in constant expressions
+constexpr std::uint64_t load(const char *p, std::size_t n) {
+  std::uint64_t v = 0;
+  for (std::size_t i = 0; i < n; ++i)
+    v |= (std::uint64_t)(unsigned char)p[i] << (8 * i);
+  return v;
+}
+
+// wyhash, final version 4
+constexpr std::uint64_t bytes(const char *p, std::size_t len,
+                              std::uint64_t seed) {
+  seed ^= mix(seed ^ secret[0], secret[1]);
+  std::uint64_t a = 0, b = 0;
+  if (len <= 16) {
+    if (len >= 4) {
+      const std::size_t mid = (len >> 3) << 2;
+      a = load(p, 4) << 32 | load(p + mid, 4);
+      b = load(p + len - 4, 4) << 32 | load(p + len - 4 - mid, 4);
+    } else if (len > 0) {
+      a = (std::uint64_t)(unsigned char)p[0] << 16 |
+          (std::uint64_t)(unsigned char)p[len >> 1] << 8 |
+          (unsigned char)p[len - 1];
+    }
+  } else {
+    std::size_t i = len;
+    if (i >= 48) {
+      std::uint64_t see1 = seed, see2 = seed;
+      do {
+        seed = mix(load(p, 8) ^ secret[1], load(p + 8, 8) ^ seed);
+        see1 = mix(load(p + 16, 8) ^ secret[2], load(p + 24, 8) ^ see1);
+        see2 = mix(load(p + 32, 8) ^ secret[3], load(p + 40, 8) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i >= 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      seed = mix(load(p, 8) ^ secret[1], load(p + 8, 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    a = load(p + i - 16, 8);
+    b = load(p + i - 8, 8);
+  }
+  const uint128 product = (uint128)(a ^ secret[1]) * (b ^ seed);
+  return mix((std::uint64_t)product ^ secret[0] ^ len,
+             (std::uint64_t)(product >> 64) ^ secret[1]);
+}
+
+// wyhash's 64 bit integer hash
+constexpr std::uint64_t integer(std::uint64_t key, std::uint64_t seed) {
+  const uint128 product = (uint128)(key ^ secret[0]) * (seed ^ secret[1]);
+  return mix((std::uint64_t)product ^ secret[0],
+             (std::uint64_t)(product >> 64) ^ secret[1]);
+}
+
+// a seed nobody can guess. one random draw per process, every call derives a
+// distinct seed from it
+inline std::uint64_t fresh_seed() {
+  static const std::uint64_t base =
+      (std::uint64_t)std::random_device()() << 32 | std::random_device()();
+  static std::atomic<std::uint64_t> drawn = 0;
+  return integer(drawn.fetch_add(1, std::memory_order_relaxed), base);
+}
+} // namespace hash_detail
+
+// the hash chashtable uses. every table picks a seed of its own, so keys that
+// collide in one table spread out in another and can't be chosen up front to
+// collide everywhere. integers go through a multiply mixer and strings through
+// wyhash; any other key has its std::hash mixed with the seed, which spreads
+// patterned hashes but can't separate keys whose std::hash is equal. char
+// pointers compare by address, so they hash by address too.
+// specialize this to hash a key type differently.
+template <class Key> struct seeded_hash {
+  constexpr std::uint64_t operator()(const Key &key, std::uint64_t seed) const {
+    if constexpr (std::is_integral_v<Key> || std::is_enum_v<Key>)
+      return hash_detail::integer((std::uint64_t)key, seed);
+    else if constexpr (!std::is_pointer_v<Key> &&
+                       std::is_convertible_v<const Key &, std::string_view>) {
+      const std::string_view s = key;
+      return hash_detail::bytes(s.data(), s.size(), seed);
+    } else
+      return hash_detail::integer(std::hash<Key>()(key), seed);
+  }
+};
+
+// a fixed number of value-initialized elements, kept inside the object when
+// there are at most N of them and on the heap otherwise. moving a small array
+// moves its elements.
+template <class T, std::size_t N> class inline_array {
+private:
+  std::size_t count = 0;
+  T *heap = nullptr;
+  std::array<T, N> local{};
+
+public:
+  using value_type = T;
+  using size_type = std::size_t;
+  using iterator = T *;
+  using const_iterator = const T *;
+
+  constexpr inline_array() = default;
+  constexpr explicit inline_array(size_type n)
+      : count{n}, heap{n > N ? new T[n]() : nullptr} {}
+  constexpr inline_array(inline_array &&move) noexcept
+      : count{std::exchange(move.count, 0)},
+        heap{std::exchange(move.heap, nullptr)}, local{std::move(move.local)} {}
+  constexpr inline_array &operator=(inline_array &&move) noexcept {
+    if (this == &move)
+      return *this;
+    delete[] heap;
+    count = std::exchange(move.count, 0);
+    heap = std::exchange(move.heap, nullptr);
+    local = std::move(move.local);
+    return *this;
+  }
+  constexpr ~inline_array() { delete[] heap; }
+
+  constexpr size_type size() const { return count; }
+  constexpr T *data() { return heap ? heap : local.data(); }
+  constexpr const T *data() const { return heap ? heap : local.data(); }
+  constexpr T &operator[](size_type idx) { return data()[idx]; }
+  constexpr const T &operator[](size_type idx) const { return data()[idx]; }
+  constexpr iterator begin() { return data(); }
+  constexpr iterator end() { return data() + count; }
+  constexpr const_iterator begin() const { return data(); }
+  constexpr const_iterator end() const { return data() + count; }
+  constexpr const_iterator cbegin() const { return data(); }
+  constexpr const_iterator cend() const { return data() + count; }
+};
+
+template <Hashable Key, class T> class chfrozenmap;
+template <Hashable Key, class T, ProbingPolicy Probing> class chcache;
+
+// what a chashmap change log records. insert and assign carry the key's new
+// value, clear has neither key nor value.
+enum class change_kind { insert, assign, erase, clear };
+
+// what recording a change does when the log is full: block waits for a
+// consumer to drain it, once the writer has released the table lock, and
+// drop discards the change and counts it.
+enum class backpressure { block, drop };
+
+template <class Key, class T> class chchangelog;
+
+// the table chashmap, chashset and chmultimap are built on: buckets holding
+// one Value each, probing, resizing and the table lock. Value is either the
+// key itself or a pair whose first member is the key.
+//
+// with Inline above zero, the first Inline entries and a table of 2 * Inline
+// buckets live inside the object, so a table that stays that small never
+// allocates. growing past it moves the buckets to the heap, while entries
+// stay where they are. moving the table moves its inline entries.
+//
+// Alloc allocates the bucket arrays of tables without inline storage,
+// rebound to the bucket type. entries are allocated with make_shared.
+template <Hashable Key, class Value, ProbingPolicy Probing = linear_probing,
+          std::size_t Inline = 0, class Alloc = std::allocator<std::byte>>
+class chashtable {
+  static_assert(Inline == 0 ||
+                    std::is_same_v<Alloc, std::allocator<std::byte>>,
+                "inline buckets don't go through an allocator");
+
 public:
   using key_type = Key;
-  using value_type = std::pair<const Key, T>;
+  using value_type = Value;
   using size_type = std::size_t;
   using difference_type = std::ptrdiff_t;
+  using probing_policy = Probing;
 
-private:
-  using bucket_content = std::pair<bool, value_type>;
+  // probe lengths count the slots a successful lookup inspects, so an entry
+  // sitting in its home bucket has a probe length of 1.
+  struct probe_statistics {
+    size_type max;
+    double mean;
+  };
+
+protected:
+  // a flag that is always false and the entry, plus the key's hash if it is
+  // cached
+  struct hashed_content : std::pair<bool, value_type> {
+    size_type hash;
+
+    template <class... Args>
+    hashed_content(size_type hash, Args &&...args)
+        : std::pair<bool, value_type>(std::forward<Args>(args)...),
+          hash{hash} {}
+  };
+  using bucket_content =
+      std::conditional_t<cache_hash_v<Key>, hashed_content,
+                         std::pair<bool, value_type>>;
   using bucket = std::shared_ptr<bucket_content>;
-  std::vector<bucket> buckets;
+  using bucket_vector = std::conditional_t<
+      Inline == 0,
+      std::vector<bucket, typename std::allocator_traits<
+                              Alloc>::template rebind_alloc<bucket>>,
+      inline_array<bucket, Inline * 2>>;
+  // an entry slot inside the object. buckets point at the slots in use
+  // without owning them.
+  union inline_entry {
+    bucket_content content;
+    inline_entry() {}
+    ~inline_entry() {}
+  };
+  bucket_vector buckets;
+  std::array<inline_entry, Inline> inline_entries;
+  std::array<bool, Inline> inline_used{};
   size_type inserted_values = 0;
+  size_type removed_values = 0;
+  float max_load = 3.0 / 4.0;
+  float min_load = 0;
+  // linear probing points every erased bucket at this address. it isn't an
+  // entry and is never dereferenced, so erasing frees the entry itself
+  alignas(bucket_content) static inline unsigned char tombstone_marker;
+  std::uint64_t seed = fresh_seed();
+  // 0 never reseeds
+  size_type max_probe = 0;
+  size_type reseeded_at = 0;
+  // shared for lookups, exclusive for anything that touches the buckets.
+  mutable table_mutex mutex;
 
 public:
+  static constexpr size_type default_capacity = Inline == 0 ? 16 : Inline * 2;
+
   class iterator {
   private:
-    friend class chashmap;
-    typename std::vector<bucket>::iterator current;
+    friend class chashtable;
+    typename bucket_vector::iterator current;
     size_type begin;
     size_type at;
     size_type end;
@@ -47,10 +488,10 @@ public:
     constexpr iterator() = default;
     constexpr iterator(const iterator &) = default;
     constexpr iterator(iterator &&) = default;
-    constexpr explicit iterator(typename std::vector<bucket>::iterator c,
+    constexpr explicit iterator(typename bucket_vector::iterator c,
                                 const size_type at, const size_type n)
         : current{c}, begin{0}, at{at}, end{n} {
-      if (*c == nullptr)
+      if (at != end && (*c == nullptr || is_tombstone(*c)))
         ++*this;
     }
     constexpr auto operator<=>(const iterator &) const = default;
@@ -70,8 +511,8 @@ public:
 
   class const_iterator {
   private:
-    friend class chashmap;
-    typename std::vector<bucket>::const_iterator current;
+    friend class chashtable;
+    typename bucket_vector::const_iterator current;
     size_type begin;
     size_type at;
     size_type end;
@@ -81,10 +522,10 @@ public:
     constexpr const_iterator(const const_iterator &) = default;
     constexpr const_iterator(const_iterator &&) = default;
     constexpr explicit const_iterator(
-        typename std::vector<bucket>::const_iterator c, const size_type at,
+        typename bucket_vector::const_iterator c, const size_type at,
         const size_type n)
         : current{c}, begin{0}, at{at}, end{n} {
-      if (*c == nullptr)
+      if (at != end && (*c == nullptr || is_tombstone(*c)))
         ++*this;
     }
     constexpr auto operator<=>(const const_iterator &) const = default;
@@ -102,9 +543,39 @@ public:
     constexpr const_iterator operator-(const difference_type) const;
   };
 
-  constexpr chashmap(const size_type initial_capacity = 16);
-  constexpr chashmap(const chashmap<Key, T> &copy);
-  constexpr chashmap(chashmap<Key, T> &&move);
+  // the result of the async_ operations. co_await completes inline when the
+  // table lock is free. otherwise it parks on the lock, and every release
+  // schedules one more attempt, until a job on the scheduler gets the lock.
+  template <class Lock, std::invocable Op, Scheduler S> class awaitable {
+  private:
+    using result_type = std::invoke_result_t<Op &>;
+    using storage_type = std::conditional_t<
+        std::is_reference_v<result_type>,
+        std::reference_wrapper<std::remove_reference_t<result_type>>,
+        result_type>;
+    table_mutex &mutex;
+    Op op;
+    S &scheduler;
+    std::optional<storage_type> result;
+
+    bool try_run();
+    // runs the operation, or parks the coroutine until the next release. true
+    // when it parked.
+    bool run_or_park(std::coroutine_handle<> handle);
+
+  public:
+    awaitable(table_mutex &mutex, Op op, S &scheduler);
+    bool await_ready();
+    bool await_suspend(std::coroutine_handle<> handle);
+    result_type await_resume();
+  };
+
+  constexpr chashtable(const size_type initial_capacity = default_capacity,
+                       const Alloc &allocator = Alloc());
+  constexpr chashtable(
+      const chashtable<Key, Value, Probing, Inline, Alloc> &copy);
+  constexpr chashtable(chashtable<Key, Value, Probing, Inline, Alloc> &&move);
+  ~chashtable();
   constexpr iterator begin();
   constexpr const_iterator begin() const;
   constexpr const_iterator cbegin() const;
@@ -114,18 +585,157 @@ public:
   std::future<bool> empty() const;
   constexpr size_type size() const;
   constexpr size_type max_size() const;
-  constexpr void clear();
+  constexpr size_type bucket_count() const;
+  constexpr float load_factor() const;
+  constexpr float max_load_factor() const;
+  void max_load_factor(float ml);
+  // erasing below the min load factor shrinks the table to half the max load
+  // factor. 0, the default, never shrinks.
+  constexpr float min_load_factor() const;
+  void min_load_factor(float ml);
+  std::future<probe_statistics> probe_stats() const;
+  // resizes the table so count entries fit without another resize
+  void reserve(size_type count);
+  // an insertion that ends up more than max_probe_length buckets away from
+  // its key's home picks a new seed and rehashes the table. to keep a set of
+  // keys that collide under every seed from rehashing on every insertion,
+  // the table has to hold twice as many entries as at the last reseed before
+  // it reseeds again.
+  constexpr size_type max_probe_length() const;
+  void max_probe_length(size_type length);
+  // the allocator of the bucket arrays
+  Alloc get_allocator() const;
+  // rehashes the table with a new seed
+  void reseed();
+  void reseed(std::uint64_t new_seed);
+  // shrinks the table to the fewest buckets that hold its entries, and drops
+  // the tombstones
+  void shrink_to_fit();
+  // with release_storage, the table also goes back to its default capacity
+  void clear(bool release_storage = false);
+  void erase(iterator pos);
+  chashtable<Key, Value, Probing, Inline, Alloc> &
+  operator=(const chashtable<Key, Value, Probing, Inline, Alloc> &copy);
+  chashtable<Key, Value, Probing, Inline, Alloc> &
+  operator=(chashtable<Key, Value, Probing, Inline, Alloc> &&move);
+
+protected:
+  template <class Lock, Scheduler S>
+  static auto make_awaitable(table_mutex &mutex, std::invocable auto op,
+                             S &scheduler);
+  static constexpr const Key &key_of(const value_type &value);
+  // the bucket pos points at
+  static constexpr size_type index_of(const iterator &pos);
+  // a new entry constructed from args, on the heap
+  template <class... Args>
+  static bucket make_bucket(size_type hash, Args &&...args);
+  static std::uint64_t fresh_seed();
+  size_type hash_key(const Key &key) const;
+  // the helpers below expect the caller to already hold the mutex.
+  size_type hash_of(const bucket_content &content) const;
+  void reseed_locked(std::uint64_t new_seed);
+  // a new entry in a free inline slot if there is one, else on the heap
+  template <class... Args>
+  bucket make_entry(size_type hash, Args &&...args);
+  // empties a bucket, freeing its inline slot
+  void release(bucket &b);
+  void release_inline_entries();
+  // takes over the inline entries the buckets moved from other point at
+  void adopt_inline_entries(
+      chashtable<Key, Value, Probing, Inline, Alloc> &other);
+  constexpr size_type probe_distance(size_type idx, size_type hash) const;
+  std::optional<size_type> locate(const Key &key) const;
+  std::optional<size_type> locate(const Key &key, size_type hash) const;
+  template <class... Args>
+  std::pair<size_type, bool> try_place(const Key &key, Args &&...args);
+  size_type place(bucket content);
+  void remove_at(size_type idx);
+  // where a scan that removes as it goes starts: an empty bucket, which stops
+  // every backward shift, so none pulls an entry the scan has already seen
+  // back in front of it
+  size_type scan_start() const;
+  void reserve_for_insert();
+  void shrink_after_erase();
+  void clear_locked(bool release_storage);
+  void rehash(size_type capacity);
+  bucket_vector allocate_buckets(size_type capacity) const;
+  static bucket_vector allocate_buckets(size_type capacity,
+                                        const Alloc &allocator);
+  static bucket tombstone();
+  static bool is_tombstone(const bucket &b);
+  bucket_vector copy_buckets() const;
+  // inserts incoming entries from several threads at once, each owning a
+  // contiguous range of buckets, and calls combine(existing, incoming) for
+  // keys that are already present. the table has to have room for all of
+  // them without resizing.
+  void place_parallel(const std::vector<const value_type *> &incoming,
+                      size_type threads, auto combine);
+  bucket place_within(const value_type &value, size_type hash,
+                      size_type last, size_type &placed, size_type &reused,
+                      auto &combine);
+};
+
+template <Hashable Key, class T, ProbingPolicy Probing = linear_probing,
+          std::size_t Inline = 0, class Alloc = std::allocator<std::byte>>
+class chashmap
+    : public chashtable<Key, std::pair<const Key, T>, Probing, Inline, Alloc> {
+  template <Hashable, class> friend class chfrozenmap;
+  template <Hashable, class, ProbingPolicy> friend class chcache;
+  using base = chashtable<Key, std::pair<const Key, T>, Probing, Inline, Alloc>;
+  using typename base::bucket;
+  using typename base::bucket_content;
+  using typename base::bucket_vector;
+  using base::buckets;
+  using base::inserted_values;
+  using base::is_tombstone;
+  using base::locate;
+  using base::make_awaitable;
+  using base::max_load;
+  using base::mutex;
+  using base::place_parallel;
+  using base::rehash;
+  using base::remove_at;
+  using base::scan_start;
+  using base::removed_values;
+  using base::reserve_for_insert;
+  using base::shrink_after_erase;
+  using base::try_place;
+
+public:
+  using typename base::const_iterator;
+  using typename base::difference_type;
+  using typename base::iterator;
+  using typename base::key_type;
+  using typename base::size_type;
+  using typename base::value_type;
+  using base::begin;
+  using base::cbegin;
+  using base::cend;
+  using base::end;
+
+  constexpr chashmap(const size_type initial_capacity = base::default_capacity,
+                     const Alloc &allocator = Alloc());
+  // builds the table from several threads, see merge_from. if a key shows
+  // up more than once, which of its values is kept is unspecified.
+  template <std::input_iterator It>
+  chashmap(It first, It last,
+           size_type threads = std::thread::hardware_concurrency());
   std::future<std::pair<iterator, bool>> insert(Key key, T value);
   std::future<std::pair<iterator, bool>> insert(value_type value);
   std::future<void> insert(std::initializer_list<value_type> values);
   std::future<std::pair<iterator, bool>> insert_or_assign(Key key, T value);
-  constexpr void erase(iterator pos);
   std::future<size_type> erase(Key key);
+  void erase(iterator pos);
+  // with release_storage, the table also goes back to its default capacity
+  void clear(bool release_storage = false);
   std::future<size_type> count(Key key) const;
   std::future<iterator> find(Key key);
   std::future<const_iterator> find(Key key) const;
   std::future<bool> contains(Key key) const;
   std::future<T *> get(Key key);
+  // a missing key is inserted with T{}, which a change log records as such.
+  // writes through the returned reference aren't recorded, a logged map
+  // should be written with insert_or_assign or merge instead.
   constexpr T &operator[](const Key &key);
   std::future<size_type>
   erase_if(std::predicate<const Key &, const T &> auto fn);
@@ -148,646 +758,3542 @@ public:
   compute(Key key, std::invocable<const T &> auto fn) const;
   std::future<T &> merge(Key key, T value,
                          std::invocable<const T &, const T &> auto fn);
-  constexpr chashmap<Key, T> &operator=(const chashmap<Key, T> &copy) = default;
-  constexpr chashmap<Key, T> &operator=(chashmap<Key, T> &&move) = default;
+  // merges every entry of other like merge(). both tables are split into
+  // ranges of buckets that threads combine without locking single keys, so
+  // fn gets called from several threads at once.
+  std::future<void>
+  merge_from(const chashmap<Key, T, Probing, Inline, Alloc> &other,
+             std::invocable<const T &, const T &> auto fn,
+             size_type threads = std::thread::hardware_concurrency());
+  std::future<chfrozenmap<Key, T>> freeze() const;
+  // from now on, every insert, assign, erase and clear is also pushed to the
+  // returned log, in the order the table lock applied them. values changed
+  // through get, operator[] or iterators aren't recorded, and neither is
+  // assigning another map to this one. copy a replica from the map after
+  // this call; replaying changes it already has leaves it the same. with
+  // backpressure::block, a change takes its place in the log under the table
+  // lock, but a writer that finds the log full waits for room only after
+  // releasing the lock, so consumers may use the map while they drain.
+  // copies of the map start without a log.
+  std::shared_ptr<chchangelog<Key, T>>
+  enable_change_log(size_type capacity = 4096,
+                    backpressure policy = backpressure::block);
+  void disable_change_log();
+
+  auto async_insert(Key key, T value);
+  auto async_insert(Key key, T value, Scheduler auto &scheduler);
+  auto async_insert_or_assign(Key key, T value);
+  auto async_insert_or_assign(Key key, T value, Scheduler auto &scheduler);
+  auto async_erase(Key key);
+  auto async_erase(Key key, Scheduler auto &scheduler);
+  auto async_contains(Key key) const;
+  auto async_contains(Key key, Scheduler auto &scheduler) const;
+  auto async_get(Key key);
+  auto async_get(Key key, Scheduler auto &scheduler);
+  auto async_compute(Key key, std::invocable<const T &> auto fn) const;
+  auto async_compute(Key key, std::invocable<const T &> auto fn,
+                     Scheduler auto &scheduler) const;
+  auto async_merge(Key key, T value,
+                   std::invocable<const T &, const T &> auto fn);
+  auto async_merge(Key key, T value,
+                   std::invocable<const T &, const T &> auto fn,
+                   Scheduler auto &scheduler);
 
 private:
-  std::future<std::pair<iterator, bool>> create(Key key, T value);
+  // shares nothing when copied, so that a copy of the map doesn't write to
+  // its original's log
+  struct change_log_handle {
+    std::shared_ptr<chchangelog<Key, T>> log;
+    change_log_handle() = default;
+    change_log_handle(const change_log_handle &) {}
+    change_log_handle(change_log_handle &&) = default;
+    change_log_handle &operator=(const change_log_handle &) { return *this; }
+    change_log_handle &operator=(change_log_handle &&) = default;
+  };
+  change_log_handle changes;
+
+  // the helpers below expect the caller to already hold the mutex.
+  void record(change_kind kind, const Key *key, const T *value);
+  std::pair<iterator, bool> insert_locked(Key key, T value);
+  std::pair<iterator, bool> insert_or_assign_locked(Key key, T value);
+  size_type erase_locked(const Key &key);
+  T *get_locked(const Key &key);
+  T &merge_locked(Key key, T value, auto &fn);
 };
 
-template <Hashable Key, class T>
-constexpr chashmap<Key, T>::chashmap(
-    const typename chashmap<Key, T>::size_type initial_capacity)
-    : buckets{initial_capacity} {
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr chashtable<Key, Value, Probing, Inline, Alloc>::chashtable(
+    const typename chashtable<Key, Value, Probing, Inline, Alloc>::size_type
+        initial_capacity,
+    const Alloc &allocator)
+    : buckets{allocate_buckets(initial_capacity, allocator)} {
   if (initial_capacity <= 0) {
     throw std::runtime_error("initial capacity needs to be non-negative");
   }
 }
 
-template <Hashable Key, class T>
-constexpr chashmap<Key, T>::chashmap(const chashmap<Key, T> &copy)
-    : buckets{copy.buckets} {}
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr chashmap<Key, T, Probing, Inline, Alloc>::chashmap(
+    const typename chashmap<Key, T, Probing, Inline, Alloc>::size_type
+        initial_capacity,
+    const Alloc &allocator)
+    : base{initial_capacity, allocator} {}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+template <std::input_iterator It>
+chashmap<Key, T, Probing, Inline, Alloc>::chashmap(
+    It first, It last,
+    typename chashmap<Key, T, Probing, Inline, Alloc>::size_type threads)
+    : base{} {
+  std::vector<value_type> values;
+  std::vector<const value_type *> incoming;
+  if constexpr (std::contiguous_iterator<It> &&
+                std::is_same_v<std::iter_value_t<It>, value_type>) {
+    for (; first != last; ++first)
+      incoming.push_back(std::to_address(first));
+  } else {
+    values = std::vector<value_type>(first, last);
+    for (auto &value : values)
+      incoming.push_back(&value);
+  }
+  if (incoming.size() / max_load * 2 + 1 > buckets.size())
+    buckets = bucket_vector(incoming.size() / max_load * 2 + 1);
+  place_parallel(incoming, threads, [](value_type &, const value_type &) {});
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr chashtable<Key, Value, Probing, Inline, Alloc>::chashtable(
+    const chashtable<Key, Value, Probing, Inline, Alloc> &copy) {
+  std::shared_lock lock(copy.mutex);
+  buckets = copy.copy_buckets();
+  inserted_values = copy.inserted_values;
+  removed_values = copy.removed_values;
+  max_load = copy.max_load;
+  min_load = copy.min_load;
+  seed = copy.seed;
+  max_probe = copy.max_probe;
+  reseeded_at = copy.reseeded_at;
+}
 
 // TODO test
-template <Hashable Key, class T>
-constexpr chashmap<Key, T>::chashmap(chashmap<Key, T> &&copy)
-    : buckets{std::move(copy.buckets)} {}
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr chashtable<Key, Value, Probing, Inline, Alloc>::chashtable(
+    chashtable<Key, Value, Probing, Inline, Alloc> &&copy) {
+  std::unique_lock lock(copy.mutex);
+  buckets = std::move(copy.buckets);
+  adopt_inline_entries(copy);
+  inserted_values = std::exchange(copy.inserted_values, 0);
+  removed_values = std::exchange(copy.removed_values, 0);
+  max_load = copy.max_load;
+  min_load = copy.min_load;
+  seed = copy.seed;
+  max_probe = copy.max_probe;
+  reseeded_at = std::exchange(copy.reseeded_at, 0);
+}
 
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::iterator chashmap<Key, T>::begin() {
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+chashtable<Key, Value, Probing, Inline, Alloc>::~chashtable() {
+  release_inline_entries();
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+chashtable<Key, Value, Probing, Inline, Alloc> &
+chashtable<Key, Value, Probing, Inline, Alloc>::operator=(
+    const chashtable<Key, Value, Probing, Inline, Alloc> &copy) {
+  if (this == &copy)
+    return *this;
+  std::unique_lock lock(mutex, std::defer_lock);
+  std::shared_lock copy_lock(copy.mutex, std::defer_lock);
+  std::lock(lock, copy_lock);
+  release_inline_entries();
+  buckets = copy.copy_buckets();
+  inserted_values = copy.inserted_values;
+  removed_values = copy.removed_values;
+  max_load = copy.max_load;
+  min_load = copy.min_load;
+  seed = copy.seed;
+  max_probe = copy.max_probe;
+  reseeded_at = copy.reseeded_at;
+  return *this;
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+chashtable<Key, Value, Probing, Inline, Alloc> &
+chashtable<Key, Value, Probing, Inline, Alloc>::operator=(
+    chashtable<Key, Value, Probing, Inline, Alloc> &&move) {
+  if (this == &move)
+    return *this;
+  std::unique_lock lock(mutex, std::defer_lock);
+  std::unique_lock move_lock(move.mutex, std::defer_lock);
+  std::lock(lock, move_lock);
+  release_inline_entries();
+  buckets = std::move(move.buckets);
+  adopt_inline_entries(move);
+  inserted_values = std::exchange(move.inserted_values, 0);
+  removed_values = std::exchange(move.removed_values, 0);
+  max_load = move.max_load;
+  min_load = move.min_load;
+  seed = move.seed;
+  max_probe = move.max_probe;
+  reseeded_at = std::exchange(move.reseeded_at, 0);
+  return *this;
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline, Alloc>::iterator
+chashtable<Key, Value, Probing, Inline, Alloc>::begin() {
   return iterator(buckets.begin(), 0, buckets.size());
 }
 
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::const_iterator
-chashmap<Key, T>::begin() const {
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline,
+                              Alloc>::const_iterator
+chashtable<Key, Value, Probing, Inline, Alloc>::begin() const {
   return cbegin();
 }
 
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::const_iterator
-chashmap<Key, T>::cbegin() const {
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline,
+                              Alloc>::const_iterator
+chashtable<Key, Value, Probing, Inline, Alloc>::cbegin() const {
   return const_iterator(buckets.cbegin(), 0, buckets.size());
 }
 
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::iterator chashmap<Key, T>::end() {
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline, Alloc>::iterator
+chashtable<Key, Value, Probing, Inline, Alloc>::end() {
   return iterator(buckets.end(), buckets.size(), buckets.size());
 }
 
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::const_iterator
-chashmap<Key, T>::end() const {
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline,
+                              Alloc>::const_iterator
+chashtable<Key, Value, Probing, Inline, Alloc>::end() const {
   return cend();
 }
 
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::const_iterator
-chashmap<Key, T>::cend() const {
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline,
+                              Alloc>::const_iterator
+chashtable<Key, Value, Probing, Inline, Alloc>::cend() const {
   return const_iterator(buckets.cend(), buckets.size(), buckets.size());
 }
 
-template <Hashable Key, class T>
-std::future<bool> chashmap<Key, T>::empty() const {
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<bool> chashtable<Key, Value, Probing, Inline, Alloc>::empty(
+    ) const {
   return std::async(std::launch::async, [&] {
-    for (bucket value : buckets) {
-      if (value && value->first)
-        return false;
-    }
-    return true;
+    std::shared_lock lock(mutex);
+    return inserted_values == 0;
   });
 }
 
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::size_type chashmap<Key, T>::size() const {
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline, Alloc>::size_type
+chashtable<Key, Value, Probing, Inline, Alloc>::size() const {
   return inserted_values;
 }
 
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::size_type
-chashmap<Key, T>::max_size() const {
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline, Alloc>::size_type
+chashtable<Key, Value, Probing, Inline, Alloc>::max_size() const {
   return std::numeric_limits<size_type>::max();
 }
 
-template <Hashable Key, class T> constexpr void chashmap<Key, T>::clear() {
-  for (auto &bucket : buckets) {
-    bucket = nullptr;
-  }
-  inserted_values = 0;
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline, Alloc>::size_type
+chashtable<Key, Value, Probing, Inline, Alloc>::bucket_count() const {
+  return buckets.size();
 }
 
-template <Hashable Key, class T>
-std::future<std::pair<typename chashmap<Key, T>::iterator, bool>>
-chashmap<Key, T>::create(Key key, T value) {
-  return std::async(std::launch::async, [&, key = std::move(key),
-                                         value = std::move(value)] {
-    int buckets_size = buckets.size();
-    size_type hash = std::hash<Key>()(key);
-    for (size_type i = 0; /*infinite loop*/; i++) {
-      size_type idx = (hash + i) % buckets_size;
-      if (buckets[idx] == nullptr) {
-        // nothing at this position
-        // create a new thing
-        buckets[idx] =
-            std::make_shared<bucket_content>(false, std::make_pair(key, value));
-        ++inserted_values;
-        return std::make_pair(
-            iterator(buckets.begin() + idx, idx, buckets.size()), true);
-      }
-      auto [is_removed, kvp] = *buckets[idx];
-      auto [tkey, tvalue] = kvp;
-      if (is_removed) {
-        // if marked for lazy deletion
-        buckets[idx] =
-            std::make_shared<bucket_content>(false, std::make_pair(key, value));
-        ++inserted_values;
-        return std::make_pair(
-            iterator(buckets.begin() + idx, idx, buckets.size()), true);
-      } else if (tkey == key) {
-        // if key is already represented
-        // no insertion, and no need to resize
-        return std::make_pair(
-            iterator(buckets.begin() + idx, idx, buckets.size()), false);
-      }
-      // continue in our linear probing
-    }
-  });
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr float chashtable<Key, Value, Probing, Inline, Alloc>::load_factor(
+    ) const {
+  return (float)inserted_values / buckets.size();
 }
 
-template <Hashable Key, class T>
-std::future<std::pair<typename chashmap<Key, T>::iterator, bool>>
-chashmap<Key, T>::insert(Key key, T value) {
-  return std::async(
-      std::launch::async, [&, key = std::move(key), value = std::move(value)] {
-        int buckets_size = buckets.size();
-        // we want to resize our pairs vector when we find that the number of
-        // inserted elements is 2/3 of our max capacity
-        // (to prevent collisions)
-        const float threshold = 3.0 / 4.0; // 1/4 of the pockets are empty
-        const float ratio = (float)inserted_values / (buckets_size);
-        if (ratio >= threshold) {
-          // we want to resize our pairs vector
-          // we will need to rehash our values
-          std::vector<bucket> oldbuckets = std::move(buckets);
-          buckets = std::vector<bucket>(oldbuckets.size() * 2 + 1);
-          inserted_values = 0;
-          for (auto bucket : oldbuckets)
-            if (bucket != nullptr) { // O(N)
-              auto [is_removed, kvp] = *bucket;
-              if (is_removed)
-                continue; // we can ignore deleted values since we are now
-                          // resetting the hashTable
-              auto [tkey, tvalue] = kvp;
-              // recursive call ALWAYS O(1) due to resize
-              // threshold was *barely* met, so since we doubled the length of
-              // pairs, the inserted_pairs will always be under the threshold.
-              insert(tkey, tvalue);
-            }
-        }
-        auto future = create(key, value);
-        future.wait();
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr float
+chashtable<Key, Value, Probing, Inline, Alloc>::max_load_factor() const {
+  return max_load;
+}
 
-        return future.get();
-      });
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+void chashtable<Key, Value, Probing, Inline, Alloc>::max_load_factor(float ml) {
+  // at least one bucket has to stay empty for probing to terminate
+  if (!(ml > 0 && ml < 1)) {
+    throw std::runtime_error("max load factor needs to be between 0 and 1");
+  }
+  std::unique_lock lock(mutex);
+  if (min_load >= ml / 2) {
+    throw std::runtime_error(
+        "max load factor needs to be above twice the min load factor");
+  }
+  max_load = ml;
 }
 
-template <Hashable Key, class T>
-std::future<std::pair<typename chashmap<Key, T>::iterator, bool>>
-chashmap<Key, T>::insert(const typename chashmap<Key, T>::value_type value) {
-  return insert(value.first, value.second);
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr float
+chashtable<Key, Value, Probing, Inline, Alloc>::min_load_factor() const {
+  return min_load;
 }
 
-template <Hashable Key, class T>
-std::future<void> chashmap<Key, T>::insert(
-    std::initializer_list<typename chashmap<Key, T>::value_type> values) {
-  return std::async(std::launch::async, [&, values = std::move(values)] {
-    std::vector<std::future<std::pair<iterator, bool>>> pool(values.size());
-    for (auto &[key, value] : values) {
-      pool.emplace_back(std::move(insert(std::move(key), std::move(value))));
-    }
-    for (auto &future : pool) {
-      future.wait();
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+void chashtable<Key, Value, Probing, Inline, Alloc>::min_load_factor(float ml) {
+  // a table shrinks to half the max load factor, which has to stay above
+  // the min or the next erase would shrink it again
+  std::unique_lock lock(mutex);
+  if (!(ml >= 0 && ml < max_load / 2)) {
+    throw std::runtime_error(
+        "min load factor needs to be between 0 and half the max load factor");
+  }
+  min_load = ml;
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<typename chashtable<Key, Value, Probing, Inline,
+                                Alloc>::probe_statistics>
+chashtable<Key, Value, Probing, Inline, Alloc>::probe_stats() const {
+  return std::async(std::launch::async, [&] {
+    std::shared_lock lock(mutex);
+    probe_statistics stats{0, 0.0};
+    size_type total = 0;
+    for (size_type idx = 0; idx < buckets.size(); ++idx) {
+      if (buckets[idx] == nullptr || is_tombstone(buckets[idx]))
+        continue;
+      size_type length = probe_distance(idx, hash_of(*buckets[idx])) + 1;
+      stats.max = std::max(stats.max, length);
+      total += length;
     }
+    if (inserted_values != 0)
+      stats.mean = (double)total / inserted_values;
+    return stats;
   });
 }
 
-template <Hashable Key, class T>
-std::future<std::pair<typename chashmap<Key, T>::iterator, bool>>
-chashmap<Key, T>::insert_or_assign(Key key, T value) {
-  return std::async(std::launch::async,
-                    [&, key = std::move(key), value = std::move(value)] {
-                      auto promise = insert(key, value);
-                      promise.wait();
-                      auto [iter, inserted] = promise.get();
-                      if (!inserted)
-                        iter->second = value;
-                      return std::make_pair(iter, true);
-                    });
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+void chashtable<Key, Value, Probing, Inline, Alloc>::reserve(size_type count) {
+  std::unique_lock lock(mutex);
+  const size_type capacity = count / max_load + 1;
+  if (capacity > buckets.size())
+    rehash(capacity);
 }
 
-template <Hashable Key, class T>
-constexpr void
-chashmap<Key, T>::erase(typename chashmap<Key, T>::iterator pos) {
-  (**pos.current).first = true;
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline, Alloc>::size_type
+chashtable<Key, Value, Probing, Inline, Alloc>::max_probe_length() const {
+  return max_probe;
 }
 
-template <Hashable Key, class T>
-std::future<typename chashmap<Key, T>::size_type>
-chashmap<Key, T>::erase(Key key) {
-  return erase_if(
-      [&, key = std::move(key)](const auto &tkey) { return tkey == key; });
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+void chashtable<Key, Value, Probing, Inline, Alloc>::max_probe_length(
+    size_type length) {
+  std::unique_lock lock(mutex);
+  max_probe = length;
 }
 
-template <Hashable Key, class T>
-std::future<typename chashmap<Key, T>::size_type>
-chashmap<Key, T>::count(Key key) const {
-  return count_if(
-      [&, key = std::move(key)](const auto &tkey) { return tkey == key; });
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+Alloc chashtable<Key, Value, Probing, Inline, Alloc>::get_allocator()
+    const {
+  if constexpr (Inline == 0)
+    return Alloc(buckets.get_allocator());
+  else
+    return Alloc();
 }
 
-template <Hashable Key, class T>
-std::future<typename chashmap<Key, T>::iterator>
-chashmap<Key, T>::find(Key key) {
-  return find_if(
-      [&, key = std::move(key)](const auto &tkey) { return tkey == key; });
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+void chashtable<Key, Value, Probing, Inline, Alloc>::reseed() {
+  reseed(fresh_seed());
 }
 
-template <Hashable Key, class T>
-std::future<typename chashmap<Key, T>::const_iterator>
-chashmap<Key, T>::find(Key key) const {
-  return find_if(
-      [&, key = std::move(key)](const auto &tkey) { return tkey == key; });
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+void chashtable<Key, Value, Probing, Inline, Alloc>::reseed(
+    std::uint64_t new_seed) {
+  std::unique_lock lock(mutex);
+  reseed_locked(new_seed);
 }
 
-// TODO test
-template <Hashable Key, class T>
-std::future<bool> chashmap<Key, T>::contains(Key key) const {
-  return contains_if(
-      [&, key = std::move(key)](const auto &tkey) { return tkey == key; });
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+void chashtable<Key, Value, Probing, Inline, Alloc>::shrink_to_fit() {
+  std::unique_lock lock(mutex);
+  rehash(std::max<size_type>(inserted_values / max_load + 1, Inline * 2));
 }
 
-template <Hashable Key, class T>
-std::future<T *> chashmap<Key, T>::get(Key key) {
-  return std::async(std::launch::async, [&, key = std::move(key)] {
-    int buckets_size = buckets.size();
-    size_type hash = std::hash<Key>()(key);
-    for (size_type i = 0; /*infinite loop*/; i++) {
-      size_type idx = (hash + i) % buckets_size;
-      if (buckets[idx] == nullptr) {
-        // nothing at this position
-        return (T *)nullptr;
-      }
-      auto &[is_removed, kvp] = *buckets[idx];
-      auto &[tkey, tvalue] = kvp;
-      if (is_removed) {
-        // if marked for lazy deletion
-        continue; // continue the search
-      } else if (tkey == key) {
-        // if key is found
-        return &tvalue;
-      }
-      // continue in our linear probing
-    }
-  });
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+void chashtable<Key, Value, Probing, Inline, Alloc>::clear(
+    bool release_storage) {
+  std::unique_lock lock(mutex);
+  clear_locked(release_storage);
 }
 
-template <Hashable Key, class T>
-constexpr T &chashmap<Key, T>::operator[](const Key &key) {
-  // it will return the reference to the key's
-  // value if it exists,
-  // if it does not exist, it will create a
-  // new KeyValuePair and return a reference
-  // to that value.
-
-  auto promise = get(key);
-  promise.wait();
-  auto value = promise.get();
-  if (value != nullptr) {
-    return *value;
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+void chashtable<Key, Value, Probing, Inline, Alloc>::clear_locked(
+    bool release_storage) {
+  for (auto &bucket : buckets) {
+    bucket = nullptr;
   }
-  auto promise2 = this->insert(
-      std::make_pair(key, T{})); // call default constructor for value
-  promise2.wait();
-  auto [iterator, inserted] = promise2.get();
-  return iterator->second;
+  release_inline_entries();
+  if (release_storage)
+    buckets = allocate_buckets(default_capacity);
+  inserted_values = 0;
+  removed_values = 0;
+  reseeded_at = 0;
 }
 
-template <Hashable Key, class T>
-std::future<typename chashmap<Key, T>::size_type>
-chashmap<Key, T>::erase_if(std::predicate<const Key &, const T &> auto fn) {
-  return std::async(std::launch::async, [&, fn = std::move(fn)] {
-    auto p1 = count_if(fn);
-    p1.wait();
-    size_type count = p1.get();
-    for (size_type i = 0; i < count; ++i) {
-      auto p = find_if(fn);
-      p.wait();
-      erase(p.get());
-    }
-    return count;
-  });
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline, Alloc>::size_type
+chashtable<Key, Value, Probing, Inline, Alloc>::index_of(
+    const typename chashtable<Key, Value, Probing, Inline,
+                              Alloc>::iterator &pos) {
+  return pos.at;
 }
 
-template <Hashable Key, class T>
-std::future<typename chashmap<Key, T>::size_type>
-chashmap<Key, T>::erase_if(std::predicate<const Key &> auto fn) {
-  return erase_if([&, fn = std::move(fn)](Key k, T) { return fn(k); });
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr const Key &chashtable<Key, Value, Probing, Inline, Alloc>::key_of(
+    const typename chashtable<Key, Value, Probing, Inline,
+                              Alloc>::value_type &value) {
+  if constexpr (std::is_same_v<std::remove_const_t<Value>, Key>)
+    return value;
+  else
+    return value.first;
 }
 
-template <Hashable Key, class T>
-std::future<typename chashmap<Key, T>::size_type> chashmap<Key, T>::count_if(
-    std::predicate<const Key &, const T &> auto fn) const {
-  return std::async(std::launch::async, [&, fn = std::move(fn)] {
-    size_type count = 0;
-    for (auto [first, second] : *this) {
-      if (fn(first, second)) {
-        count++;
-      }
-    }
-    return count;
-  });
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+template <class... Args>
+typename chashtable<Key, Value, Probing, Inline, Alloc>::bucket
+chashtable<Key, Value, Probing, Inline, Alloc>::make_bucket(
+    size_type hash, Args &&...args) {
+  if constexpr (cache_hash_v<Key>)
+    return std::make_shared<bucket_content>(
+        hash, std::piecewise_construct, std::forward_as_tuple(false),
+        std::forward_as_tuple(std::forward<Args>(args)...));
+  else
+    return std::make_shared<bucket_content>(
+        std::piecewise_construct, std::forward_as_tuple(false),
+        std::forward_as_tuple(std::forward<Args>(args)...));
 }
 
-template <Hashable Key, class T>
-std::future<typename chashmap<Key, T>::size_type>
-chashmap<Key, T>::count_if(std::predicate<const Key &> auto fn) const {
-  return count_if([&, fn = std::move(fn)](Key k, T) { return fn(k); });
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+template <class... Args>
+typename chashtable<Key, Value, Probing, Inline, Alloc>::bucket
+chashtable<Key, Value, Probing, Inline, Alloc>::make_entry(size_type hash,
+                                                           Args &&...args) {
+  for (size_type k = 0; k < Inline; ++k) {
+    if (inline_used[k])
+      continue;
+    bucket_content *content = &inline_entries[k].content;
+    if constexpr (cache_hash_v<Key>)
+      std::construct_at(content, hash, std::piecewise_construct,
+                        std::forward_as_tuple(false),
+                        std::forward_as_tuple(std::forward<Args>(args)...));
+    else
+      std::construct_at(content, std::piecewise_construct,
+                        std::forward_as_tuple(false),
+                        std::forward_as_tuple(std::forward<Args>(args)...));
+    inline_used[k] = true;
+    // aliasing an empty pointer gives a bucket that owns nothing
+    return bucket(bucket(), content);
+  }
+  return make_bucket(hash, std::forward<Args>(args)...);
 }
 
-template <Hashable Key, class T>
-std::future<typename chashmap<Key, T>::iterator>
-chashmap<Key, T>::find_if(std::predicate<const Key &, const T &> auto fn) {
-  return std::async(std::launch::async, [&, fn = std::move(fn)] {
-    for (auto iter = begin(); iter != end(); iter++) {
-      if (fn(iter->first, iter->second)) {
-        return iter;
-      }
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+void chashtable<Key, Value, Probing, Inline, Alloc>::release(bucket &b) {
+  // only compares addresses, so threads placing into separate ranges of
+  // buckets can release their own entries at the same time
+  for (size_type k = 0; k < Inline; ++k) {
+    if (b.get() == &inline_entries[k].content) {
+      std::destroy_at(&inline_entries[k].content);
+      inline_used[k] = false;
+      break;
     }
-    return end();
-  });
+  }
+  b = nullptr;
 }
 
-template <Hashable Key, class T>
-std::future<typename chashmap<Key, T>::iterator>
-chashmap<Key, T>::find_if(std::predicate<const Key &> auto fn) {
-  return find_if([&, fn = std::move(fn)](Key k, T) { return fn(k); });
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+void chashtable<Key, Value, Probing, Inline, Alloc>::release_inline_entries() {
+  // the buckets pointing at them have to be gone or about to be replaced
+  for (size_type k = 0; k < Inline; ++k) {
+    if (inline_used[k]) {
+      std::destroy_at(&inline_entries[k].content);
+      inline_used[k] = false;
+    }
+  }
 }
 
-template <Hashable Key, class T>
-std::future<typename chashmap<Key, T>::const_iterator>
-chashmap<Key, T>::find_if(
-    std::predicate<const Key &, const T &> auto fn) const {
-  return std::async(std::launch::async, [&, fn = std::move(fn)] {
-    for (auto iter = cbegin(); iter != cend(); iter++) {
-      if (fn(iter->first, iter->second)) {
-        return iter;
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+void chashtable<Key, Value, Probing, Inline, Alloc>::adopt_inline_entries(
+    chashtable<Key, Value, Probing, Inline, Alloc> &other) {
+  // an inline entry moves into the slot with the same index here, and every
+  // bucket pointing at it follows
+  auto adopt = [&](bucket &b) {
+    for (size_type k = 0; b != nullptr && k < Inline; ++k) {
+      if (b.get() != &other.inline_entries[k].content)
+        continue;
+      if (other.inline_used[k]) {
+        bucket_content &from = other.inline_entries[k].content;
+        std::construct_at(&inline_entries[k].content, std::move(from));
+        std::destroy_at(&from);
+        other.inline_used[k] = false;
+        inline_used[k] = true;
       }
+      b = bucket(bucket(), &inline_entries[k].content);
+      break;
     }
-    return cend();
-  });
+  };
+  for (auto &b : buckets)
+    adopt(b);
 }
 
-template <Hashable Key, class T>
-std::future<typename chashmap<Key, T>::const_iterator>
-chashmap<Key, T>::find_if(std::predicate<const Key &> auto fn) const {
-  return find_if([&, fn = std::move(fn)](Key k, T) { return fn(k); });
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::uint64_t chashtable<Key, Value, Probing, Inline, Alloc>::fresh_seed() {
+  return hash_detail::fresh_seed();
 }
 
-// TODO test
-template <Hashable Key, class T>
-std::future<bool> chashmap<Key, T>::contains(
-    std::predicate<const Key &, const T &> auto fn) const {
-  return std::async(std::launch::async, [&, fn = std::move(fn)] {
-    auto p = find_if(fn);
-    p.wait();
-    return p.get() != cend();
-  });
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+typename chashtable<Key, Value, Probing, Inline, Alloc>::size_type
+chashtable<Key, Value, Probing, Inline, Alloc>::hash_key(const Key &key) const {
+  return seeded_hash<Key>()(key, seed);
 }
 
-// TODO test
-template <Hashable Key, class T>
-std::future<bool>
-chashmap<Key, T>::contains(std::predicate<const T &> auto fn) const {
-  return contains([&, fn = std::move(fn)](Key, T k) { return fn(k); });
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+typename chashtable<Key, Value, Probing, Inline, Alloc>::size_type
+chashtable<Key, Value, Probing, Inline, Alloc>::hash_of(
+    const bucket_content &content) const {
+  if constexpr (cache_hash_v<Key>)
+    return content.hash;
+  else
+    return hash_key(key_of(content.second));
 }
 
-template <Hashable Key, class T>
-std::future<std::optional<T>> chashmap<Key, T>::compute(
-    Key key, std::invocable<const Key &, const T &> auto fn) const {
-  return std::async(std::launch::async,
-                    [&, key = std::move(key), fn = std::move(fn)] {
-                      auto p = find(key);
-                      p.wait();
-                      const_iterator valptr = p.get();
-                      if (valptr == cend())
-                        return std::optional<T>{};
-                      auto [tkey, tvalue] = *valptr;
-                      return std::make_optional(fn(tkey, tvalue));
-                    });
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+void chashtable<Key, Value, Probing, Inline, Alloc>::reseed_locked(
+    std::uint64_t new_seed) {
+  seed = new_seed;
+  reseeded_at = inserted_values;
+  if constexpr (cache_hash_v<Key>)
+    for (auto &b : buckets)
+      if (b != nullptr && !is_tombstone(b))
+        b->hash = hash_key(key_of(b->second));
+  rehash(buckets.size());
 }
 
-template <Hashable Key, class T>
-std::future<std::optional<T>>
-chashmap<Key, T>::compute(Key key, std::invocable<const T &> auto fn) const {
-  return compute(
-      key, [&, key = key, fn = std::move(fn)](Key, T t) { return fn(t); });
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline, Alloc>::size_type
+chashtable<Key, Value, Probing, Inline, Alloc>::probe_distance(
+    size_type idx, size_type hash) const {
+  const size_type buckets_size = buckets.size();
+  return (idx + buckets_size - hash % buckets_size) % buckets_size;
 }
 
-template <Hashable Key, class T>
-std::future<T &>
-chashmap<Key, T>::merge(Key key, T value,
-                        std::invocable<const T &, const T &> auto fn) {
-  return std::async(std::launch::async,
-                    [&, key = std::move(key), value = std::move(value),
-                     fn = std::move(fn)]() -> T & {
-                      auto p = insert(key, value);
-                      p.wait();
-                      auto [iter, inserted] = p.get();
-                      if (inserted)
-                        return (*this)[key];
-                      // else key exists
-                      auto &[_, tvalue] = *iter;
-                      auto p1 = insert_or_assign(key, fn(value, tvalue));
-                      p1.wait();
-                      return (*this)[key];
-                    });
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::optional<typename chashtable<Key, Value, Probing, Inline,
+                                  Alloc>::size_type>
+chashtable<Key, Value, Probing, Inline, Alloc>::locate(const Key &key) const {
+  return locate(key, hash_key(key));
 }
 
-template <Hashable Key, class T>
-constexpr bool chashmap<Key, T>::iterator::operator==(
-    const typename chashmap<Key, T>::iterator &it) const {
-  return current == it.current;
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::optional<typename chashtable<Key, Value, Probing, Inline,
+                                  Alloc>::size_type>
+chashtable<Key, Value, Probing, Inline, Alloc>::locate(
+    const Key &key, size_type hash) const {
+  const size_type buckets_size = buckets.size();
+  for (size_type i = 0; i < buckets_size; i++) {
+    size_type idx = (hash + i) % buckets_size;
+    if (buckets[idx] == nullptr) {
+      // nothing at this position, so the key was never placed further along
+      return std::nullopt;
+    }
+    if (is_tombstone(buckets[idx]))
+      continue;
+    const bucket_content &content = *buckets[idx];
+    if constexpr (std::is_same_v<Probing, robin_hood_probing>) {
+      // the resident is closer to home than we would be, insertion would
+      // have displaced it
+      if (probe_distance(idx, hash_of(content)) < i)
+        return std::nullopt;
+    }
+    if constexpr (cache_hash_v<Key>) {
+      // only a matching hash makes comparing the keys worth it
+      if (content.hash != hash)
+        continue;
+    }
+    if (key_of(content.second) == key) {
+      return idx;
+    }
+    // continue in our linear probing
+  }
+  return std::nullopt;
 }
 
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::value_type &
-chashmap<Key, T>::iterator::operator*() {
-  return (*current)->second;
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+template <class... Args>
+std::pair<typename chashtable<Key, Value, Probing, Inline,
+                              Alloc>::size_type, bool>
+chashtable<Key, Value, Probing, Inline, Alloc>::try_place(
+    const Key &key, Args &&...args) {
+  const size_type hash = hash_key(key);
+  if (auto idx = locate(key, hash)) {
+    // if key is already represented
+    // no insertion
+    return std::make_pair(*idx, false);
+  }
+  size_type idx = place(make_entry(hash, std::forward<Args>(args)...));
+  if (max_probe != 0 && probe_distance(idx, hash) >= max_probe &&
+      inserted_values >= reseeded_at * 2) {
+    // args may have been moved from key, so find the entry by its own key.
+    // entries keep their address through the rehash
+    const bucket_content &placed = *buckets[idx];
+    reseed_locked(fresh_seed());
+    idx = *locate(key_of(placed.second), hash_of(placed));
+  }
+  return std::make_pair(idx, true);
 }
 
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::value_type *
-chashmap<Key, T>::iterator::operator->() {
-  return &(*current)->second;
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+typename chashtable<Key, Value, Probing, Inline, Alloc>::size_type
+chashtable<Key, Value, Probing, Inline, Alloc>::place(bucket content) {
+  // the key is known to be absent and at least one bucket is empty
+  const size_type buckets_size = buckets.size();
+  size_type idx = hash_of(*content) % buckets_size;
+  ++inserted_values;
+  if constexpr (std::is_same_v<Probing, linear_probing>) {
+    // the first empty or lazily deleted bucket wins
+    while (buckets[idx] != nullptr && !is_tombstone(buckets[idx]))
+      idx = (idx + 1) % buckets_size;
+    if (buckets[idx] != nullptr)
+      --removed_values;
+    buckets[idx] = std::move(content);
+    return idx;
+  } else {
+    std::optional<size_type> placed;
+    size_type distance = 0;
+    while (buckets[idx] != nullptr) {
+      size_type resident_distance =
+          probe_distance(idx, hash_of(*buckets[idx]));
+      if (resident_distance < distance) {
+        // the resident is richer than the entry we carry, so it gives up its
+        // bucket and we continue probing on its behalf
+        std::swap(content, buckets[idx]);
+        if (!placed)
+          placed = idx;
+        distance = resident_distance;
+      }
+      idx = (idx + 1) % buckets_size;
+      ++distance;
+    }
+    buckets[idx] = std::move(content);
+    return placed.value_or(idx);
+  }
 }
 
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::value_type &
-chashmap<Key, T>::iterator::operator[](difference_type index) {
-  return current[index];
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+void chashtable<Key, Value, Probing, Inline, Alloc>::remove_at(size_type idx) {
+  --inserted_values;
+  if constexpr (std::is_same_v<Probing, linear_probing>) {
+    // lazy deletion: the entry is freed, its bucket keeps probes going
+    ++removed_values;
+    release(buckets[idx]);
+    buckets[idx] = tombstone();
+  } else {
+    // backward shift: pull every displaced entry of the run one bucket closer
+    // to its home, until we reach an empty bucket or an entry already at home
+    const size_type buckets_size = buckets.size();
+    release(buckets[idx]);
+    for (size_type next = (idx + 1) % buckets_size;
+         buckets[next] != nullptr &&
+         probe_distance(next, hash_of(*buckets[next])) > 0;
+         next = (next + 1) % buckets_size) {
+      buckets[idx] = std::move(buckets[next]);
+      idx = next;
+    }
+  }
 }
 
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::iterator &
-chashmap<Key, T>::iterator::operator++() {
-  if (at == end)
-    return *this;
-  do {
-    ++current;
-    ++at;
-  } while (at != end && (*current == nullptr || (*current)->first == true));
-  return *this;
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+typename chashtable<Key, Value, Probing, Inline, Alloc>::size_type
+chashtable<Key, Value, Probing, Inline, Alloc>::scan_start() const {
+  size_type start = 0;
+  // linear probing leaves tombstones and never moves an entry
+  if constexpr (std::is_same_v<Probing, robin_hood_probing>)
+    while (start < buckets.size() && buckets[start] != nullptr)
+      ++start;
+  return start;
 }
 
-// TODO test
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::iterator
-chashmap<Key, T>::iterator::operator++(int) {
-  auto res = *this;
-  ++*this;
-  return res;
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+void chashtable<Key, Value, Probing, Inline, Alloc>::reserve_for_insert() {
+  // we want to resize our buckets vector when the used buckets pass the max
+  // load factor (to prevent collisions), and always keep one bucket empty
+  const size_type used = inserted_values + removed_values;
+  const float ratio = (float)used / buckets.size();
+  if (used + 1 >= buckets.size() || ratio >= max_load) {
+    // when tombstones make up most of the load, clearing them out is enough
+    // and a table with a churning but bounded key set stops growing
+    if ((float)(inserted_values + 1) / buckets.size() < max_load / 2)
+      rehash(buckets.size());
+    else
+      rehash(buckets.size() * 2 + 1);
+  }
 }
 
-// TODO test
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::iterator &
-chashmap<Key, T>::iterator::operator+=(const difference_type n) {
-  if (n < 0)
-    return (*this -= -n);
-  for (difference_type i = 0; i < n; ++i) {
-    ++*this;
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+void chashtable<Key, Value, Probing, Inline, Alloc>::shrink_after_erase() {
+  // called once an erasing operation is done, never in the middle of a scan
+  if (min_load == 0 || buckets.size() <= default_capacity ||
+      (float)inserted_values / buckets.size() >= min_load)
+    return;
+  const size_type capacity = std::max<size_type>(
+      inserted_values / (max_load / 2) + 1, default_capacity);
+  if (capacity < buckets.size())
+    rehash(capacity);
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+void chashtable<Key, Value, Probing, Inline, Alloc>::rehash(
+    size_type capacity) {
+  bucket_vector oldbuckets =
+      std::exchange(buckets, allocate_buckets(capacity));
+  inserted_values = 0;
+  removed_values = 0;
+  for (auto &bucket : oldbuckets)
+    if (bucket != nullptr && !is_tombstone(bucket)) // O(N)
+      // we can ignore deleted values since we are now resetting the
+      // hashTable, and the surviving entries keep their address
+      place(std::move(bucket));
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+typename chashtable<Key, Value, Probing, Inline, Alloc>::bucket_vector
+chashtable<Key, Value, Probing, Inline, Alloc>::allocate_buckets(
+    size_type capacity) const {
+  return allocate_buckets(capacity, get_allocator());
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+typename chashtable<Key, Value, Probing, Inline, Alloc>::bucket_vector
+chashtable<Key, Value, Probing, Inline, Alloc>::allocate_buckets(
+    size_type capacity, const Alloc &allocator) {
+  if constexpr (Inline == 0)
+    return bucket_vector(capacity, allocator);
+  else
+    return bucket_vector(capacity);
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+typename chashtable<Key, Value, Probing, Inline, Alloc>::bucket_vector
+chashtable<Key, Value, Probing, Inline, Alloc>::copy_buckets() const {
+  // the copy gets entries of its own, so changing a value in one table
+  // doesn't show up in the other
+  bucket_vector copy(buckets.size());
+  for (size_type idx = 0; idx < buckets.size(); ++idx) {
+    if (is_tombstone(buckets[idx]))
+      copy[idx] = tombstone();
+    else if (buckets[idx] != nullptr)
+      copy[idx] = std::make_shared<bucket_content>(*buckets[idx]);
   }
-  return *this;
+  return copy;
 }
 
-// TODO test
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::iterator
-chashmap<Key, T>::iterator::operator+(const difference_type n) const {
-  auto res = *this;
-  res += n;
-  return res;
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+typename chashtable<Key, Value, Probing, Inline, Alloc>::bucket
+chashtable<Key, Value, Probing, Inline, Alloc>::tombstone() {
+  // aliasing an empty pointer gives a bucket that owns nothing
+  return bucket(bucket(),
+                reinterpret_cast<bucket_content *>(&tombstone_marker));
 }
 
-// TODO test
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::iterator &
-chashmap<Key, T>::iterator::operator--() {
-  if (at == begin)
-    return *this;
-  do {
-    --current;
-    --at;
-  } while (at != begin && (*current == nullptr || (*current)->first == true));
-  return *this;
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+bool chashtable<Key, Value, Probing, Inline, Alloc>::is_tombstone(
+    const bucket &b) {
+  return b.get() == reinterpret_cast<bucket_content *>(&tombstone_marker);
 }
 
-// TODO test
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::iterator
-chashmap<Key, T>::iterator::operator--(int) {
-  auto res = *this;
-  --*this;
-  return res;
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+void chashtable<Key, Value, Probing, Inline, Alloc>::place_parallel(
+    const std::vector<const value_type *> &incoming, size_type threads,
+    auto combine) {
+  const size_type buckets_size = buckets.size();
+  // small ranges would leave most entries to the sequential pass at the end
+  const size_type partitions =
+      std::max<size_type>(1, std::min(threads, buckets_size / 1024));
+  auto bound = [&](size_type p) { return p * buckets_size / partitions; };
+  auto partition_of = [&](size_type home) {
+    size_type p = home * partitions / buckets_size;
+    while (home >= bound(p + 1))
+      ++p;
+    return p;
+  };
+
+  // every thread hashes a slice of incoming and routes it by home bucket
+  using routed_entry = std::pair<size_type, const value_type *>;
+  std::vector<std::vector<std::vector<routed_entry>>> routed(
+      partitions, std::vector<std::vector<routed_entry>>(partitions));
+  std::vector<std::future<void>> pool;
+  for (size_type t = 0; t < partitions; ++t) {
+    pool.push_back(std::async(std::launch::async, [&, t] {
+      const size_type end = (t + 1) * incoming.size() / partitions;
+      for (size_type i = t * incoming.size() / partitions; i < end; ++i) {
+        const size_type hash = hash_key(key_of(*incoming[i]));
+        routed[t][partition_of(hash % buckets_size)].emplace_back(
+            hash, incoming[i]);
+      }
+    }));
+  }
+  for (auto &future : pool)
+    future.get();
+  pool.clear();
+
+  // then every thread places the entries whose home lies in its range, and
+  // never reads or writes a bucket outside of it
+  std::vector<std::vector<bucket>> deferred(partitions);
+  std::vector<size_type> placed(partitions, 0);
+  std::vector<size_type> reused(partitions, 0);
+  for (size_type p = 0; p < partitions; ++p) {
+    pool.push_back(std::async(std::launch::async, [&, p] {
+      for (size_type t = 0; t < partitions; ++t)
+        for (auto [hash, value] : routed[t][p])
+          if (bucket rest = place_within(*value, hash, bound(p + 1),
+                                         placed[p], reused[p], combine))
+            deferred[p].push_back(std::move(rest));
+    }));
+  }
+  for (auto &future : pool)
+    future.get();
+  for (size_type p = 0; p < partitions; ++p) {
+    inserted_values += placed[p];
+    removed_values -= reused[p];
+  }
+
+  // whatever would have crossed into the next range
+  for (auto &rest : deferred) {
+    for (auto &content : rest) {
+      if (auto idx = locate(key_of(content->second), hash_of(*content)))
+        combine(buckets[*idx]->second, content->second);
+      else
+        place(std::move(content));
+    }
+  }
 }
 
-// TODO test
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::iterator &
-chashmap<Key, T>::iterator::operator-=(const difference_type n) {
-  if (n < 0)
-    return (*this += -n);
-  for (difference_type i = 0; i < n; ++i) {
-    --*this;
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+typename chashtable<Key, Value, Probing, Inline, Alloc>::bucket
+chashtable<Key, Value, Probing, Inline, Alloc>::place_within(
+    const value_type &value, size_type hash, size_type last, size_type &placed,
+    size_type &reused, auto &combine) {
+  // returns an entry that has to be placed after the parallel pass, because
+  // finding or placing it means probing past last
+  const Key &key = key_of(value);
+  const size_type home = hash % buckets.size();
+  std::optional<size_type> removed;
+  size_type idx = home;
+  size_type distance = 0;
+  for (;; ++idx, ++distance) {
+    if (idx == last)
+      return make_bucket(hash, value);
+    const bucket &b = buckets[idx];
+    if (b == nullptr)
+      break;
+    if constexpr (std::is_same_v<Probing, robin_hood_probing>) {
+      if (probe_distance(idx, hash_of(*b)) < distance)
+        break;
+    }
+    if (is_tombstone(b)) {
+      if (!removed)
+        removed = idx;
+    } else if (hash_of(*b) == hash && key_of(b->second) == key) {
+      combine(b->second, value);
+      return nullptr;
+    }
+  }
+
+  bucket content = make_bucket(hash, value);
+  ++placed;
+  if constexpr (std::is_same_v<Probing, linear_probing>) {
+    if (removed) {
+      idx = *removed;
+      ++reused;
+    }
+    buckets[idx] = std::move(content);
+    return nullptr;
+  } else {
+    // carry on like place() from the first bucket we can take
+    for (;; ++idx, ++distance) {
+      if (idx == last) {
+        --placed;
+        return content;
+      }
+      if (buckets[idx] == nullptr) {
+        buckets[idx] = std::move(content);
+        return nullptr;
+      }
+      size_type resident_distance =
+          probe_distance(idx, hash_of(*buckets[idx]));
+      if (resident_distance < distance) {
+        std::swap(content, buckets[idx]);
+        distance = resident_distance;
+      }
+    }
   }
-  return *this;
 }
 
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::iterator
-chashmap<Key, T>::iterator::operator-(const difference_type n) const {
-  auto res = *this;
-  res += n;
-  return res;
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<
+    std::pair<typename chashmap<Key, T, Probing, Inline,
+                                Alloc>::iterator, bool>>
+chashmap<Key, T, Probing, Inline, Alloc>::insert(Key key, T value) {
+  return std::async(std::launch::async, [&, key = std::move(key),
+                                         value = std::move(value)] {
+    std::unique_lock lock(mutex);
+    return insert_locked(key, value);
+  });
 }
 
-template <Hashable Key, class T>
-constexpr bool chashmap<Key, T>::const_iterator::operator==(
-    const typename chashmap<Key, T>::const_iterator &it) const {
-  return current == it.current;
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<
+    std::pair<typename chashmap<Key, T, Probing, Inline,
+                                Alloc>::iterator, bool>>
+chashmap<Key, T, Probing, Inline, Alloc>::insert(
+    const typename chashmap<Key, T, Probing, Inline, Alloc>::value_type value) {
+  return insert(value.first, value.second);
 }
 
-template <Hashable Key, class T>
-constexpr const typename chashmap<Key, T>::value_type &
-chashmap<Key, T>::const_iterator::operator*() {
-  return (*current)->second;
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<void> chashmap<Key, T, Probing, Inline, Alloc>::insert(
+    std::initializer_list<
+        typename chashmap<Key, T, Probing, Inline, Alloc>::value_type>
+        values) {
+  // the list's array only lives until the caller's statement ends, so the
+  // values are copied before the task can outlive it
+  return std::async(std::launch::async,
+                    [&, values = std::vector<value_type>(values)] {
+                      std::unique_lock lock(mutex);
+                      for (auto &[key, value] : values) {
+                        insert_locked(key, value);
+                      }
+                    });
 }
 
-template <Hashable Key, class T>
-constexpr const typename chashmap<Key, T>::value_type *
-chashmap<Key, T>::const_iterator::operator->() {
-  return &(*current)->second;
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<
+    std::pair<typename chashmap<Key, T, Probing, Inline,
+                                Alloc>::iterator, bool>>
+chashmap<Key, T, Probing, Inline, Alloc>::insert_or_assign(Key key, T value) {
+  return std::async(std::launch::async, [&, key = std::move(key),
+                                         value = std::move(value)] {
+    std::unique_lock lock(mutex);
+    return insert_or_assign_locked(key, value);
+  });
 }
 
-// TODO test
-template <Hashable Key, class T>
-constexpr const typename chashmap<Key, T>::value_type &
-chashmap<Key, T>::const_iterator::operator[](difference_type index) {
-  return current[index];
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+void chashtable<Key, Value, Probing, Inline, Alloc>::erase(
+    typename chashtable<Key, Value, Probing, Inline, Alloc>::iterator pos) {
+  std::unique_lock lock(mutex);
+  remove_at(pos.at);
+  shrink_after_erase();
 }
 
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::const_iterator &
-chashmap<Key, T>::const_iterator::operator++() {
-  if (at == end)
-    return *this;
-  do {
-    ++current;
-    ++at;
-  } while (at != end && (*current == nullptr || (*current)->first == true));
-  return *this;
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<typename chashmap<Key, T, Probing, Inline, Alloc>::size_type>
+chashmap<Key, T, Probing, Inline, Alloc>::erase(Key key) {
+  return std::async(std::launch::async, [&, key = std::move(key)] {
+    std::unique_lock lock(mutex);
+    return erase_locked(key);
+  });
 }
 
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::const_iterator
-chashmap<Key, T>::const_iterator::operator++(int) {
-  auto res = *this;
-  ++*this;
-  return res;
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+void chashmap<Key, T, Probing, Inline, Alloc>::erase(
+    typename chashmap<Key, T, Probing, Inline, Alloc>::iterator pos) {
+  std::unique_lock lock(mutex);
+  const size_type idx = base::index_of(pos);
+  record(change_kind::erase, &buckets[idx]->second.first, nullptr);
+  remove_at(idx);
+  shrink_after_erase();
 }
 
-// TODO test
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::const_iterator &
-chashmap<Key, T>::const_iterator::operator+=(const difference_type n) {
-  if (n < 0)
-    return (*this -= -n);
-  for (difference_type i = 0; i < n; ++i) {
-    ++*this;
-  }
-  return *this;
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+void chashmap<Key, T, Probing, Inline, Alloc>::clear(bool release_storage) {
+  std::unique_lock lock(mutex);
+  base::clear_locked(release_storage);
+  record(change_kind::clear, nullptr, nullptr);
 }
 
-// TODO test
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::const_iterator
-chashmap<Key, T>::const_iterator::operator+(const difference_type n) const {
-  auto res = *this;
-  res += n;
-  return res;
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<typename chashmap<Key, T, Probing, Inline, Alloc>::size_type>
+chashmap<Key, T, Probing, Inline, Alloc>::count(Key key) const {
+  return std::async(std::launch::async, [&, key = std::move(key)] {
+    std::shared_lock lock(mutex);
+    return locate(key) ? size_type{1} : size_type{0};
+  });
 }
 
-// TODO test
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::const_iterator &
-chashmap<Key, T>::const_iterator::operator--() {
-  if (at == begin)
-    return *this;
-  do {
-    --current;
-    --at;
-  } while (at != begin && (*current == nullptr || (*current)->first == true));
-  return *this;
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<typename chashmap<Key, T, Probing, Inline, Alloc>::iterator>
+chashmap<Key, T, Probing, Inline, Alloc>::find(Key key) {
+  return std::async(std::launch::async, [&, key = std::move(key)] {
+    std::shared_lock lock(mutex);
+    auto idx = locate(key);
+    if (!idx)
+      return end();
+    return iterator(buckets.begin() + *idx, *idx, buckets.size());
+  });
 }
 
-// TODO test
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::const_iterator
-chashmap<Key, T>::const_iterator::operator--(int) {
-  auto res = *this;
-  --*this;
-  return res;
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<typename chashmap<Key, T, Probing, Inline, Alloc>::const_iterator>
+chashmap<Key, T, Probing, Inline, Alloc>::find(Key key) const {
+  return std::async(std::launch::async, [&, key = std::move(key)] {
+    std::shared_lock lock(mutex);
+    auto idx = locate(key);
+    if (!idx)
+      return cend();
+    return const_iterator(buckets.cbegin() + *idx, *idx, buckets.size());
+  });
 }
 
-// TODO test
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::const_iterator &
-chashmap<Key, T>::const_iterator::operator-=(const difference_type n) {
-  if (n < 0)
-    return (*this += -n);
-  for (difference_type i = 0; i < n; ++i) {
-    --*this;
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<bool> chashmap<Key, T, Probing, Inline, Alloc>::contains(
+    Key key) const {
+  return std::async(std::launch::async, [&, key = std::move(key)] {
+    std::shared_lock lock(mutex);
+    return locate(key).has_value();
+  });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<T *> chashmap<Key, T, Probing, Inline, Alloc>::get(Key key) {
+  return std::async(std::launch::async, [&, key = std::move(key)] {
+    std::shared_lock lock(mutex);
+    return get_locked(key);
+  });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr T &chashmap<Key, T, Probing, Inline, Alloc>::operator[](
+    const Key &key) {
+  // it will return the reference to the key's
+  // value if it exists,
+  // if it does not exist, it will create a
+  // new KeyValuePair and return a reference
+  // to that value.
+
+  auto promise = get(key);
+  promise.wait();
+  auto value = promise.get();
+  if (value != nullptr) {
+    return *value;
   }
-  return *this;
+  auto promise2 = this->insert(
+      std::make_pair(key, T{})); // call default constructor for value
+  promise2.wait();
+  auto [iterator, inserted] = promise2.get();
+  return iterator->second;
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<typename chashmap<Key, T, Probing, Inline, Alloc>::size_type>
+chashmap<Key, T, Probing, Inline, Alloc>::erase_if(
+    std::predicate<const Key &, const T &> auto fn) {
+  return std::async(std::launch::async, [&, fn = std::move(fn)] {
+    std::unique_lock lock(mutex);
+    size_type count = 0;
+    const size_type start = scan_start();
+    for (size_type step = 0; step < buckets.size();) {
+      const size_type idx = (start + step) % buckets.size();
+      const bucket &b = buckets[idx];
+      if (b != nullptr && !is_tombstone(b) &&
+          fn(b->second.first, b->second.second)) {
+        record(change_kind::erase, &b->second.first, nullptr);
+        remove_at(idx);
+        count++;
+        // a backward shift pulled the next entry into this bucket
+        if constexpr (std::is_same_v<Probing, robin_hood_probing>)
+          continue;
+      }
+      ++step;
+    }
+    shrink_after_erase();
+    return count;
+  });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<typename chashmap<Key, T, Probing, Inline, Alloc>::size_type>
+chashmap<Key, T, Probing, Inline, Alloc>::erase_if(
+    std::predicate<const Key &> auto fn) {
+  return erase_if([&, fn = std::move(fn)](Key k, T) { return fn(k); });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<typename chashmap<Key, T, Probing, Inline, Alloc>::size_type>
+chashmap<Key, T, Probing, Inline, Alloc>::count_if(
+    std::predicate<const Key &, const T &> auto fn) const {
+  return std::async(std::launch::async, [&, fn = std::move(fn)] {
+    std::shared_lock lock(mutex);
+    size_type count = 0;
+    for (auto [first, second] : *this) {
+      if (fn(first, second)) {
+        count++;
+      }
+    }
+    return count;
+  });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<typename chashmap<Key, T, Probing, Inline, Alloc>::size_type>
+chashmap<Key, T, Probing, Inline, Alloc>::count_if(
+    std::predicate<const Key &> auto fn) const {
+  return count_if([&, fn = std::move(fn)](Key k, T) { return fn(k); });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<typename chashmap<Key, T, Probing, Inline, Alloc>::iterator>
+chashmap<Key, T, Probing, Inline, Alloc>::find_if(
+    std::predicate<const Key &, const T &> auto fn) {
+  return std::async(std::launch::async, [&, fn = std::move(fn)] {
+    std::shared_lock lock(mutex);
+    for (auto iter = begin(); iter != end(); iter++) {
+      if (fn(iter->first, iter->second)) {
+        return iter;
+      }
+    }
+    return end();
+  });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<typename chashmap<Key, T, Probing, Inline, Alloc>::iterator>
+chashmap<Key, T, Probing, Inline, Alloc>::find_if(
+    std::predicate<const Key &> auto fn) {
+  return find_if([&, fn = std::move(fn)](Key k, T) { return fn(k); });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<typename chashmap<Key, T, Probing, Inline, Alloc>::const_iterator>
+chashmap<Key, T, Probing, Inline, Alloc>::find_if(
+    std::predicate<const Key &, const T &> auto fn) const {
+  return std::async(std::launch::async, [&, fn = std::move(fn)] {
+    std::shared_lock lock(mutex);
+    for (auto iter = cbegin(); iter != cend(); iter++) {
+      if (fn(iter->first, iter->second)) {
+        return iter;
+      }
+    }
+    return cend();
+  });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<typename chashmap<Key, T, Probing, Inline, Alloc>::const_iterator>
+chashmap<Key, T, Probing, Inline, Alloc>::find_if(
+    std::predicate<const Key &> auto fn) const {
+  return find_if([&, fn = std::move(fn)](Key k, T) { return fn(k); });
 }
 
 // TODO test
-template <Hashable Key, class T>
-constexpr typename chashmap<Key, T>::const_iterator
-chashmap<Key, T>::const_iterator::operator-(const difference_type n) const {
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<bool> chashmap<Key, T, Probing, Inline, Alloc>::contains(
+    std::predicate<const Key &, const T &> auto fn) const {
+  return std::async(std::launch::async, [&, fn = std::move(fn)] {
+    auto p = find_if(fn);
+    p.wait();
+    return p.get() != cend();
+  });
+}
+
+// TODO test
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<bool>
+chashmap<Key, T, Probing, Inline, Alloc>::contains(
+    std::predicate<const T &> auto fn) const {
+  return contains([&, fn = std::move(fn)](Key, T k) { return fn(k); });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<std::optional<T>> chashmap<Key, T, Probing, Inline, Alloc>::compute(
+    Key key, std::invocable<const Key &, const T &> auto fn) const {
+  return std::async(std::launch::async,
+                    [&, key = std::move(key),
+                     fn = std::move(fn)]() -> std::optional<T> {
+                      std::shared_lock lock(mutex);
+                      auto idx = locate(key);
+                      if (!idx)
+                        return std::optional<T>{};
+                      auto &[tkey, tvalue] = buckets[*idx]->second;
+                      return std::make_optional<T>(fn(tkey, tvalue));
+                    });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<std::optional<T>>
+chashmap<Key, T, Probing, Inline, Alloc>::compute(
+    Key key, std::invocable<const T &> auto fn) const {
+  return compute(
+      key, [&, key = key, fn = std::move(fn)](Key, T t) { return fn(t); });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<T &>
+chashmap<Key, T, Probing, Inline, Alloc>::merge(
+    Key key, T value, std::invocable<const T &, const T &> auto fn) {
+  return std::async(std::launch::async,
+                    [&, key = std::move(key), value = std::move(value),
+                     fn = std::move(fn)]() -> T & {
+                      std::unique_lock lock(mutex);
+                      return merge_locked(key, value, fn);
+                    });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<void> chashmap<Key, T, Probing, Inline, Alloc>::merge_from(
+    const chashmap<Key, T, Probing, Inline, Alloc> &other,
+    std::invocable<const T &, const T &> auto fn,
+    typename chashmap<Key, T, Probing, Inline, Alloc>::size_type threads) {
+  return std::async(std::launch::async, [&, fn = std::move(fn), threads] {
+    if (this == &other) {
+      throw std::runtime_error("cannot merge a map into itself");
+    }
+    std::unique_lock lock(mutex, std::defer_lock);
+    std::shared_lock other_lock(other.mutex, std::defer_lock);
+    std::lock(lock, other_lock);
+    std::vector<const value_type *> incoming;
+    incoming.reserve(other.inserted_values);
+    for (auto &b : other.buckets)
+      if (b != nullptr && !is_tombstone(b))
+        incoming.push_back(&b->second);
+    // make room for every key of other up front, nothing below resizes
+    const size_type used = inserted_values + removed_values + incoming.size();
+    if (used + 1 >= buckets.size() || (float)used / buckets.size() >= max_load)
+      rehash((inserted_values + incoming.size()) / max_load * 2 + 1);
+    std::vector<bool> existed;
+    if (changes.log)
+      for (auto *kvp : incoming)
+        existed.push_back(locate(kvp->first).has_value());
+    place_parallel(incoming, threads,
+                   [&](value_type &ours, const value_type &theirs) {
+                     ours.second = fn(theirs.second, ours.second);
+                   });
+    // recorded afterwards, in the order of other's buckets
+    for (size_type i = 0; i < existed.size(); ++i) {
+      const Key &key = incoming[i]->first;
+      record(existed[i] ? change_kind::assign : change_kind::insert, &key,
+             &buckets[*locate(key)]->second.second);
+    }
+  });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::pair<typename chashmap<Key, T, Probing, Inline, Alloc>::iterator, bool>
+chashmap<Key, T, Probing, Inline, Alloc>::insert_locked(Key key, T value) {
+  reserve_for_insert();
+  auto [idx, inserted] = try_place(key, key, std::move(value));
+  if (inserted)
+    record(change_kind::insert, &key, &buckets[idx]->second.second);
+  return std::make_pair(iterator(buckets.begin() + idx, idx, buckets.size()),
+                        inserted);
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::pair<typename chashmap<Key, T, Probing, Inline, Alloc>::iterator, bool>
+chashmap<Key, T, Probing, Inline, Alloc>::insert_or_assign_locked(
+    Key key, T value) {
+  reserve_for_insert();
+  auto [idx, inserted] = try_place(key, key, value);
+  if (!inserted)
+    buckets[idx]->second.second = std::move(value);
+  record(inserted ? change_kind::insert : change_kind::assign, &key,
+         &buckets[idx]->second.second);
+  return std::make_pair(iterator(buckets.begin() + idx, idx, buckets.size()),
+                        true);
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+typename chashmap<Key, T, Probing, Inline, Alloc>::size_type
+chashmap<Key, T, Probing, Inline, Alloc>::erase_locked(const Key &key) {
+  auto idx = locate(key);
+  if (!idx)
+    return 0;
+  record(change_kind::erase, &key, nullptr);
+  remove_at(*idx);
+  shrink_after_erase();
+  return 1;
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+void chashmap<Key, T, Probing, Inline, Alloc>::record(change_kind kind,
+                                                      const Key *key,
+                                                      const T *value) {
+  if (changes.log == nullptr)
+    return;
+  typename chchangelog<Key, T>::change change{kind, std::nullopt, std::nullopt};
+  if (key != nullptr)
+    change.key.emplace(*key);
+  if (value != nullptr)
+    change.value.emplace(*value);
+  chchangelog<Key, T> &log = *changes.log;
+  if (log.policy() == backpressure::drop) {
+    log.push(std::move(change));
+    return;
+  }
+  // claiming the position under the lock keeps the lock's order, waiting
+  // for the slot to drain has to wait until the lock is released
+  const size_type pos = log.claim();
+  if (!log.try_publish(pos, change))
+    table_mutex::after_unlock(
+        [ring = changes.log, pos, change = std::move(change)]() mutable {
+          ring->publish(pos, std::move(change));
+        });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+T *chashmap<Key, T, Probing, Inline, Alloc>::get_locked(const Key &key) {
+  auto idx = locate(key);
+  if (!idx)
+    return nullptr;
+  return &buckets[*idx]->second.second;
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+T &chashmap<Key, T, Probing, Inline, Alloc>::merge_locked(
+    Key key, T value, auto &fn) {
+  reserve_for_insert();
+  auto [idx, inserted] = try_place(key, key, value);
+  auto &tvalue = buckets[idx]->second.second;
+  if (!inserted)
+    // else key exists
+    tvalue = fn(value, tvalue);
+  record(inserted ? change_kind::insert : change_kind::assign, &key, &tvalue);
+  return tvalue;
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+template <class Lock, Scheduler S>
+auto chashtable<Key, Value, Probing, Inline, Alloc>::make_awaitable(
+    table_mutex &mutex, std::invocable auto op, S &scheduler) {
+  return awaitable<Lock, decltype(op), S>(mutex, std::move(op), scheduler);
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+auto chashmap<Key, T, Probing, Inline, Alloc>::async_insert(Key key, T value) {
+  static inline_scheduler scheduler;
+  return async_insert(std::move(key), std::move(value), scheduler);
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+auto chashmap<Key, T, Probing, Inline, Alloc>::async_insert(
+    Key key, T value, Scheduler auto &scheduler) {
+  return this->template make_awaitable<std::unique_lock<table_mutex>>(
+      mutex,
+      [this, key = std::move(key), value = std::move(value)] {
+        return insert_locked(key, value);
+      },
+      scheduler);
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+auto chashmap<Key, T, Probing, Inline, Alloc>::async_insert_or_assign(
+    Key key, T value) {
+  static inline_scheduler scheduler;
+  return async_insert_or_assign(std::move(key), std::move(value), scheduler);
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+auto chashmap<Key, T, Probing, Inline, Alloc>::async_insert_or_assign(
+    Key key, T value, Scheduler auto &scheduler) {
+  return this->template make_awaitable<std::unique_lock<table_mutex>>(
+      mutex,
+      [this, key = std::move(key), value = std::move(value)] {
+        return insert_or_assign_locked(key, value);
+      },
+      scheduler);
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+auto chashmap<Key, T, Probing, Inline, Alloc>::async_erase(Key key) {
+  static inline_scheduler scheduler;
+  return async_erase(std::move(key), scheduler);
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+auto chashmap<Key, T, Probing, Inline, Alloc>::async_erase(
+    Key key, Scheduler auto &scheduler) {
+  return this->template make_awaitable<std::unique_lock<table_mutex>>(
+      mutex, [this, key = std::move(key)] { return erase_locked(key); },
+      scheduler);
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+auto chashmap<Key, T, Probing, Inline, Alloc>::async_contains(Key key) const {
+  static inline_scheduler scheduler;
+  return async_contains(std::move(key), scheduler);
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+auto chashmap<Key, T, Probing, Inline, Alloc>::async_contains(
+    Key key, Scheduler auto &scheduler) const {
+  return this->template make_awaitable<std::shared_lock<table_mutex>>(
+      mutex, [this, key = std::move(key)] { return locate(key).has_value(); },
+      scheduler);
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+auto chashmap<Key, T, Probing, Inline, Alloc>::async_get(Key key) {
+  static inline_scheduler scheduler;
+  return async_get(std::move(key), scheduler);
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+auto chashmap<Key, T, Probing, Inline, Alloc>::async_get(
+    Key key, Scheduler auto &scheduler) {
+  return this->template make_awaitable<std::shared_lock<table_mutex>>(
+      mutex, [this, key = std::move(key)] { return get_locked(key); },
+      scheduler);
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+auto chashmap<Key, T, Probing, Inline, Alloc>::async_compute(
+    Key key, std::invocable<const T &> auto fn) const {
+  static inline_scheduler scheduler;
+  return async_compute(std::move(key), std::move(fn), scheduler);
+}
+
+// unlike async_get, the result is a copy made under the lock, so it stays
+// valid while other threads write to the entry.
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+auto chashmap<Key, T, Probing, Inline, Alloc>::async_compute(
+    Key key, std::invocable<const T &> auto fn,
+    Scheduler auto &scheduler) const {
+  return this->template make_awaitable<std::shared_lock<table_mutex>>(
+      mutex,
+      [this, key = std::move(key), fn = std::move(fn)]() -> std::optional<T> {
+        auto idx = locate(key);
+        if (!idx)
+          return std::nullopt;
+        return fn(buckets[*idx]->second.second);
+      },
+      scheduler);
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+auto chashmap<Key, T, Probing, Inline, Alloc>::async_merge(
+    Key key, T value, std::invocable<const T &, const T &> auto fn) {
+  static inline_scheduler scheduler;
+  return async_merge(std::move(key), std::move(value), std::move(fn),
+                     scheduler);
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+auto chashmap<Key, T, Probing, Inline, Alloc>::async_merge(
+    Key key, T value, std::invocable<const T &, const T &> auto fn,
+    Scheduler auto &scheduler) {
+  return this->template make_awaitable<std::unique_lock<table_mutex>>(
+      mutex,
+      [this, key = std::move(key), value = std::move(value),
+       fn = std::move(fn)]() -> T & { return merge_locked(key, value, fn); },
+      scheduler);
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+template <class Lock, std::invocable Op, Scheduler S>
+chashtable<Key, Value, Probing, Inline, Alloc>::awaitable<Lock, Op,
+                                                          S>::awaitable(
+    table_mutex &mutex, Op op, S &scheduler)
+    : mutex{mutex}, op{std::move(op)}, scheduler{scheduler} {}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+template <class Lock, std::invocable Op, Scheduler S>
+bool
+chashtable<Key, Value, Probing, Inline, Alloc>::awaitable<Lock, Op,
+                                                          S>::try_run() {
+  Lock lock(mutex, std::try_to_lock);
+  if (!lock.owns_lock())
+    return false;
+  result.emplace(op());
+  return true;
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+template <class Lock, std::invocable Op, Scheduler S>
+bool
+chashtable<Key, Value, Probing, Inline, Alloc>::awaitable<Lock, Op,
+                                                          S>::run_or_park(
+    std::coroutine_handle<> handle) {
+  constexpr bool shared = std::is_same_v<Lock, std::shared_lock<table_mutex>>;
+  for (;;) {
+    if (try_run())
+      return false;
+    // once parked, the coroutine may be resumed on another thread before
+    // park() returns, so nothing here may touch the awaitable afterwards
+    if (mutex.park(
+            [this, handle] {
+              scheduler.schedule([this, handle] {
+                if (!run_or_park(handle))
+                  handle.resume();
+              });
+            },
+            shared))
+      return true;
+    // released in the meantime, try again right away
+  }
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+template <class Lock, std::invocable Op, Scheduler S>
+bool
+chashtable<Key, Value, Probing, Inline, Alloc>::awaitable<Lock, Op,
+                                                          S>::await_ready() {
+  return try_run();
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+template <class Lock, std::invocable Op, Scheduler S>
+bool
+chashtable<Key, Value, Probing, Inline, Alloc>::awaitable<Lock, Op,
+                                                          S>::await_suspend(
+    std::coroutine_handle<> handle) {
+  if constexpr (std::is_same_v<S, inline_scheduler>) {
+    Lock lock(mutex);
+    result.emplace(op());
+    return false;
+  } else {
+    return run_or_park(handle);
+  }
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+template <class Lock, std::invocable Op, Scheduler S>
+typename chashtable<Key, Value, Probing, Inline,
+                    Alloc>::template awaitable<Lock, Op, S>::result_type
+chashtable<Key, Value, Probing, Inline, Alloc>::awaitable<Lock, Op,
+                                                          S>::await_resume() {
+  if constexpr (std::is_reference_v<result_type>)
+    return result->get();
+  else
+    return std::move(*result);
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr bool
+chashtable<Key, Value, Probing, Inline, Alloc>::iterator::operator==(
+    const typename chashtable<Key, Value, Probing, Inline, Alloc>::iterator &it)
+    const {
+  return current == it.current;
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline, Alloc>::value_type &
+chashtable<Key, Value, Probing, Inline, Alloc>::iterator::operator*() {
+  return (*current)->second;
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline, Alloc>::value_type *
+chashtable<Key, Value, Probing, Inline, Alloc>::iterator::operator->() {
+  return &(*current)->second;
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline, Alloc>::value_type &
+chashtable<Key, Value, Probing, Inline, Alloc>::iterator::operator[](
+    difference_type index) {
+  return current[index];
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline, Alloc>::iterator &
+chashtable<Key, Value, Probing, Inline, Alloc>::iterator::operator++() {
+  if (at == end)
+    return *this;
+  do {
+    ++current;
+    ++at;
+  } while (at != end && (*current == nullptr || is_tombstone(*current)));
+  return *this;
+}
+
+// TODO test
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline, Alloc>::iterator
+chashtable<Key, Value, Probing, Inline, Alloc>::iterator::operator++(int) {
+  auto res = *this;
+  ++*this;
+  return res;
+}
+
+// TODO test
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline, Alloc>::iterator &
+chashtable<Key, Value, Probing, Inline, Alloc>::iterator::operator+=(
+    const difference_type n) {
+  if (n < 0)
+    return (*this -= -n);
+  for (difference_type i = 0; i < n; ++i) {
+    ++*this;
+  }
+  return *this;
+}
+
+// TODO test
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline, Alloc>::iterator
+chashtable<Key, Value, Probing, Inline, Alloc>::iterator::operator+(
+    const difference_type n) const {
+  auto res = *this;
+  res += n;
+  return res;
+}
+
+// TODO test
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline, Alloc>::iterator &
+chashtable<Key, Value, Probing, Inline, Alloc>::iterator::operator--() {
+  if (at == begin)
+    return *this;
+  do {
+    --current;
+    --at;
+  } while (at != begin && (*current == nullptr || is_tombstone(*current)));
+  return *this;
+}
+
+// TODO test
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline, Alloc>::iterator
+chashtable<Key, Value, Probing, Inline, Alloc>::iterator::operator--(int) {
+  auto res = *this;
+  --*this;
+  return res;
+}
+
+// TODO test
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline, Alloc>::iterator &
+chashtable<Key, Value, Probing, Inline, Alloc>::iterator::operator-=(
+    const difference_type n) {
+  if (n < 0)
+    return (*this += -n);
+  for (difference_type i = 0; i < n; ++i) {
+    --*this;
+  }
+  return *this;
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline, Alloc>::iterator
+chashtable<Key, Value, Probing, Inline, Alloc>::iterator::operator-(
+    const difference_type n) const {
+  auto res = *this;
+  res += n;
+  return res;
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr bool
+chashtable<Key, Value, Probing, Inline, Alloc>::const_iterator::operator==(
+    const typename chashtable<Key, Value, Probing, Inline,
+                              Alloc>::const_iterator &it)
+    const {
+  return current == it.current;
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr const typename chashtable<Key, Value, Probing, Inline,
+                                    Alloc>::value_type &
+chashtable<Key, Value, Probing, Inline, Alloc>::const_iterator::operator*() {
+  return (*current)->second;
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr const typename chashtable<Key, Value, Probing, Inline,
+                                    Alloc>::value_type *
+chashtable<Key, Value, Probing, Inline, Alloc>::const_iterator::operator->() {
+  return &(*current)->second;
+}
+
+// TODO test
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr const typename chashtable<Key, Value, Probing, Inline,
+                                    Alloc>::value_type &
+chashtable<Key, Value, Probing, Inline, Alloc>::const_iterator::operator[](
+    difference_type index) {
+  return current[index];
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline,
+                              Alloc>::const_iterator &
+chashtable<Key, Value, Probing, Inline, Alloc>::const_iterator::operator++() {
+  if (at == end)
+    return *this;
+  do {
+    ++current;
+    ++at;
+  } while (at != end && (*current == nullptr || is_tombstone(*current)));
+  return *this;
+}
+
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline,
+                              Alloc>::const_iterator
+chashtable<Key, Value, Probing, Inline, Alloc>::const_iterator::operator++(
+    int) {
+  auto res = *this;
+  ++*this;
+  return res;
+}
+
+// TODO test
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline,
+                              Alloc>::const_iterator &
+chashtable<Key, Value, Probing, Inline, Alloc>::const_iterator::operator+=(
+    const difference_type n) {
+  if (n < 0)
+    return (*this -= -n);
+  for (difference_type i = 0; i < n; ++i) {
+    ++*this;
+  }
+  return *this;
+}
+
+// TODO test
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline,
+                              Alloc>::const_iterator
+chashtable<Key, Value, Probing, Inline, Alloc>::const_iterator::operator+(
+    const difference_type n) const {
+  auto res = *this;
+  res += n;
+  return res;
+}
+
+// TODO test
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline,
+                              Alloc>::const_iterator &
+chashtable<Key, Value, Probing, Inline, Alloc>::const_iterator::operator--() {
+  if (at == begin)
+    return *this;
+  do {
+    --current;
+    --at;
+  } while (at != begin && (*current == nullptr || is_tombstone(*current)));
+  return *this;
+}
+
+// TODO test
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline,
+                              Alloc>::const_iterator
+chashtable<Key, Value, Probing, Inline, Alloc>::const_iterator::operator--(
+    int) {
+  auto res = *this;
+  --*this;
+  return res;
+}
+
+// TODO test
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline,
+                              Alloc>::const_iterator &
+chashtable<Key, Value, Probing, Inline, Alloc>::const_iterator::operator-=(
+    const difference_type n) {
+  if (n < 0)
+    return (*this += -n);
+  for (difference_type i = 0; i < n; ++i) {
+    --*this;
+  }
+  return *this;
+}
+
+// TODO test
+template <Hashable Key, class Value, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+constexpr typename chashtable<Key, Value, Probing, Inline,
+                              Alloc>::const_iterator
+chashtable<Key, Value, Probing, Inline, Alloc>::const_iterator::operator-(
+    const difference_type n) const {
   auto res = *this;
   res += n;
   return res;
 }
 
+// an immutable snapshot of a chashmap for maps that are built once and then
+// only read. entries are packed into one vector, and a robin hood table at
+// 90% load maps keys to them; every slot holds a 7 bit fragment of the key's
+// hash, so probing rarely touches an entry that doesn't match. like a live
+// table, every snapshot hashes with a seed of its own. lookups take no locks
+// and complete on the calling thread.
+template <Hashable Key, class T> class chfrozenmap {
+  template <Hashable, class, ProbingPolicy, std::size_t, class>
+  friend class chashmap;
+
+public:
+  using key_type = Key;
+  using value_type = std::pair<const Key, T>;
+  using size_type = std::size_t;
+  using const_iterator = typename std::vector<value_type>::const_iterator;
+
+private:
+  // low byte: 0x80 | hash fragment, or 0 for an empty slot.
+  // high byte: distance of the slot's entry from its home slot, where 0xff
+  // stands for 0xff or more.
+  using control_type = std::uint16_t;
+  std::vector<value_type> entries;
+  std::vector<control_type> control;
+  std::vector<std::uint32_t> index;
+  std::uint64_t seed = 0;
+
+  explicit chfrozenmap(std::vector<value_type> entries);
+  void build(size_type capacity);
+  constexpr size_type home(std::uint64_t hash) const;
+  static constexpr std::uint8_t fragment(std::uint64_t hash);
+
+public:
+  chfrozenmap() : chfrozenmap(std::vector<value_type>{}) {}
+  constexpr const_iterator begin() const;
+  constexpr const_iterator end() const;
+  constexpr size_type size() const;
+  constexpr bool empty() const;
+  // bytes held by the snapshot, not counting memory the keys and values own
+  constexpr size_type memory_usage() const;
+  const_iterator find(const Key &key) const;
+  const T *get(const Key &key) const;
+  const T &at(const Key &key) const;
+  bool contains(const Key &key) const;
+  size_type count(const Key &key) const;
+  template <ProbingPolicy Probing = linear_probing>
+  chashmap<Key, T, Probing> thaw() const;
+};
+
+template <Hashable Key, class T>
+chfrozenmap<Key, T>::chfrozenmap(std::vector<value_type> entries)
+    : entries{std::move(entries)} {
+  if (this->entries.size() > std::numeric_limits<std::uint32_t>::max()) {
+    throw std::runtime_error("too many entries to freeze");
+  }
+  build(this->entries.size() * 10 / 9 + 1);
+}
+
+template <Hashable Key, class T>
+void chfrozenmap<Key, T>::build(size_type capacity) {
+  control.assign(capacity, 0);
+  index.assign(capacity, 0);
+  seed = hash_detail::fresh_seed();
+  for (std::uint32_t i = 0; i < entries.size(); ++i) {
+    const std::uint64_t hash = seeded_hash<Key>()(entries[i].first, seed);
+    size_type idx = home(hash);
+    std::uint32_t carried = i;
+    control_type carried_control = 0x80 | fragment(hash);
+    while (control[idx] != 0) {
+      if ((control[idx] >> 8) < (carried_control >> 8)) {
+        // the resident is richer, it gives up its slot
+        std::swap(carried, index[idx]);
+        std::swap(carried_control, control[idx]);
+      }
+      if (++idx == capacity)
+        idx = 0;
+      // keys sharing a hash can run longer than a byte counts, growing the
+      // table wouldn't separate them
+      if ((carried_control >> 8) != 0xff)
+        carried_control += 0x100;
+    }
+    control[idx] = carried_control;
+    index[idx] = carried;
+  }
+}
+
+template <Hashable Key, class T>
+constexpr typename chfrozenmap<Key, T>::size_type
+chfrozenmap<Key, T>::home(std::uint64_t hash) const {
+  // the hash scaled to [0, capacity), no division needed. the product takes
+  // 128 bits, so that any capacity fits
+  return ((hash_detail::uint128)hash * control.size()) >> 64;
+}
+
+template <Hashable Key, class T>
+constexpr std::uint8_t chfrozenmap<Key, T>::fragment(std::uint64_t hash) {
+  return hash & 0x7f;
+}
+
+template <Hashable Key, class T>
+constexpr typename chfrozenmap<Key, T>::const_iterator
+chfrozenmap<Key, T>::begin() const {
+  return entries.cbegin();
+}
+
+template <Hashable Key, class T>
+constexpr typename chfrozenmap<Key, T>::const_iterator
+chfrozenmap<Key, T>::end() const {
+  return entries.cend();
+}
+
+template <Hashable Key, class T>
+constexpr typename chfrozenmap<Key, T>::size_type
+chfrozenmap<Key, T>::size() const {
+  return entries.size();
+}
+
+template <Hashable Key, class T>
+constexpr bool chfrozenmap<Key, T>::empty() const {
+  return entries.empty();
+}
+
+template <Hashable Key, class T>
+constexpr typename chfrozenmap<Key, T>::size_type
+chfrozenmap<Key, T>::memory_usage() const {
+  return sizeof(*this) + entries.capacity() * sizeof(value_type) +
+         control.capacity() * sizeof(control_type) +
+         index.capacity() * sizeof(std::uint32_t);
+}
+
+template <Hashable Key, class T>
+typename chfrozenmap<Key, T>::const_iterator
+chfrozenmap<Key, T>::find(const Key &key) const {
+  const std::uint64_t hash = seeded_hash<Key>()(key, seed);
+  const control_type wanted = 0x80 | fragment(hash);
+  size_type idx = home(hash);
+  for (size_type distance = 0;; ++distance) {
+    const control_type slot = control[idx];
+    // an empty slot or a richer resident ends the run our key would be in.
+    // a saturated distance may be anything, so it never ends the run
+    const size_type resident = slot >> 8;
+    if (slot == 0 || (resident < distance && resident != 0xff))
+      return end();
+    if ((slot & 0xff) == wanted && entries[index[idx]].first == key)
+      return begin() + index[idx];
+    if (++idx == control.size())
+      idx = 0;
+  }
+}
+
+template <Hashable Key, class T>
+const T *chfrozenmap<Key, T>::get(const Key &key) const {
+  auto iter = find(key);
+  return iter == end() ? nullptr : &iter->second;
+}
+
+template <Hashable Key, class T>
+const T &chfrozenmap<Key, T>::at(const Key &key) const {
+  if (auto value = get(key))
+    return *value;
+  throw std::out_of_range("key is not in the frozen map");
+}
+
+template <Hashable Key, class T>
+bool chfrozenmap<Key, T>::contains(const Key &key) const {
+  return find(key) != end();
+}
+
+template <Hashable Key, class T>
+typename chfrozenmap<Key, T>::size_type
+chfrozenmap<Key, T>::count(const Key &key) const {
+  return contains(key) ? 1 : 0;
+}
+
+template <Hashable Key, class T>
+template <ProbingPolicy Probing>
+chashmap<Key, T, Probing> chfrozenmap<Key, T>::thaw() const {
+  // sized so that no insertion below has to resize
+  chashmap<Key, T, Probing> map(entries.size() * 2 + 1);
+  for (auto &[key, value] : entries)
+    map.place(map.make_bucket(map.hash_key(key), key, value));
+  return map;
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::future<chfrozenmap<Key, T>>
+chashmap<Key, T, Probing, Inline, Alloc>::freeze() const {
+  return std::async(std::launch::async, [&] {
+    std::shared_lock lock(mutex);
+    std::vector<value_type> entries;
+    entries.reserve(inserted_values);
+    for (auto &kvp : *this)
+      entries.push_back(kvp);
+    return chfrozenmap<Key, T>(std::move(entries));
+  });
+}
+
+// a map whose N entries are known when the program is built, such as
+// protocol codes or config keys. it is built by a constexpr constructor, so a
+// constexpr chstaticmap lives in read-only data and costs nothing at startup.
+// the table is linear probed at most half full, and every slot keeps the high
+// half of its key's hash, so a probe compares keys only when those match.
+// the keys are chosen by whoever writes the map, so the seed is fixed.
+template <Hashable Key, class T, std::size_t N> class chstaticmap {
+  static_assert(N > 0, "a static map needs at least one entry");
+  static_assert(N < std::numeric_limits<std::uint32_t>::max(),
+                "too many entries for a static map");
+
+public:
+  using key_type = Key;
+  using value_type = std::pair<const Key, T>;
+  using size_type = std::size_t;
+  using const_iterator = typename std::array<value_type, N>::const_iterator;
+
+  static constexpr std::uint64_t seed = hash_detail::secret[2];
+
+private:
+  static constexpr size_type buckets = std::bit_ceil(N * 2);
+  struct slot {
+    // 0 for an empty slot, else one past the entry's index
+    std::uint32_t entry;
+    std::uint32_t fragment;
+  };
+  std::array<value_type, N> entries;
+  std::array<slot, buckets> slots{};
+
+public:
+  // throws, which stops a constant evaluation, if a key shows up twice
+  constexpr chstaticmap(const value_type (&entries)[N]);
+  constexpr const_iterator begin() const;
+  constexpr const_iterator end() const;
+  constexpr size_type size() const;
+  constexpr bool empty() const;
+  constexpr size_type bucket_count() const;
+  constexpr const_iterator find(const Key &key) const;
+  constexpr const T *get(const Key &key) const;
+  constexpr const T &at(const Key &key) const;
+  constexpr bool contains(const Key &key) const;
+  constexpr size_type count(const Key &key) const;
+};
+
+template <Hashable Key, class T, std::size_t N>
+constexpr chstaticmap<Key, T, N>::chstaticmap(const value_type (&entries)[N])
+    : entries{std::to_array(entries)} {
+  for (std::uint32_t i = 0; i < N; ++i) {
+    const Key &key = this->entries[i].first;
+    const std::uint64_t hash = seeded_hash<Key>()(key, seed);
+    size_type idx = hash & (buckets - 1);
+    while (slots[idx].entry != 0) {
+      if (this->entries[slots[idx].entry - 1].first == key) {
+        throw std::runtime_error("a key shows up twice in a static map");
+      }
+      idx = (idx + 1) & (buckets - 1);
+    }
+    slots[idx] = slot{i + 1, (std::uint32_t)(hash >> 32)};
+  }
+}
+
+template <Hashable Key, class T, std::size_t N>
+constexpr typename chstaticmap<Key, T, N>::const_iterator
+chstaticmap<Key, T, N>::begin() const {
+  return entries.cbegin();
+}
+
+template <Hashable Key, class T, std::size_t N>
+constexpr typename chstaticmap<Key, T, N>::const_iterator
+chstaticmap<Key, T, N>::end() const {
+  return entries.cend();
+}
+
+template <Hashable Key, class T, std::size_t N>
+constexpr typename chstaticmap<Key, T, N>::size_type
+chstaticmap<Key, T, N>::size() const {
+  return N;
+}
+
+template <Hashable Key, class T, std::size_t N>
+constexpr bool chstaticmap<Key, T, N>::empty() const {
+  return false;
+}
+
+template <Hashable Key, class T, std::size_t N>
+constexpr typename chstaticmap<Key, T, N>::size_type
+chstaticmap<Key, T, N>::bucket_count() const {
+  return buckets;
+}
+
+template <Hashable Key, class T, std::size_t N>
+constexpr typename chstaticmap<Key, T, N>::const_iterator
+chstaticmap<Key, T, N>::find(const Key &key) const {
+  const std::uint64_t hash = seeded_hash<Key>()(key, seed);
+  const auto fragment = (std::uint32_t)(hash >> 32);
+  // at most half the slots are taken, so an empty one ends every probe
+  for (size_type idx = hash & (buckets - 1);; idx = (idx + 1) & (buckets - 1)) {
+    const slot &s = slots[idx];
+    if (s.entry == 0)
+      return end();
+    if (s.fragment == fragment && entries[s.entry - 1].first == key)
+      return begin() + (s.entry - 1);
+  }
+}
+
+template <Hashable Key, class T, std::size_t N>
+constexpr const T *chstaticmap<Key, T, N>::get(const Key &key) const {
+  auto iter = find(key);
+  return iter == end() ? nullptr : &iter->second;
+}
+
+template <Hashable Key, class T, std::size_t N>
+constexpr const T &chstaticmap<Key, T, N>::at(const Key &key) const {
+  // comparing the address of an entry with nullptr isn't a constant
+  // expression under -fsanitize=undefined, comparing iterators is
+  if (auto iter = find(key); iter != end())
+    return iter->second;
+  throw std::out_of_range("key is not in the static map");
+}
+
+template <Hashable Key, class T, std::size_t N>
+constexpr bool chstaticmap<Key, T, N>::contains(const Key &key) const {
+  return find(key) != end();
+}
+
+template <Hashable Key, class T, std::size_t N>
+constexpr typename chstaticmap<Key, T, N>::size_type
+chstaticmap<Key, T, N>::count(const Key &key) const {
+  return contains(key) ? 1 : 0;
+}
+
+// a bounded ring of the changes made to a chashmap, see
+// chashmap::enable_change_log. any number of threads push and drain at once
+// without a lock: every slot carries a sequence number telling whether it
+// waits for a writer or for a reader, so a writer and a reader only meet on
+// the slot they both want.
+template <class Key, class T> class chchangelog {
+public:
+  using size_type = std::size_t;
+
+  struct change {
+    change_kind kind;
+    std::optional<Key> key;
+    std::optional<T> value;
+  };
+
+  // capacity is rounded up to a power of two, and to at least 2
+  explicit chchangelog(size_type capacity,
+                       backpressure policy = backpressure::block);
+  chchangelog(const chchangelog &) = delete;
+  chchangelog &operator=(const chchangelog &) = delete;
+  // false when the log was full and the change was dropped
+  bool push(change c);
+  // moves up to max changes, oldest first, to the end of into, and returns
+  // how many it moved
+  size_type drain(std::vector<change> &into,
+                  size_type max = std::numeric_limits<size_type>::max());
+  constexpr size_type capacity() const;
+  constexpr backpressure policy() const;
+  // how many changes were dropped, with backpressure::drop
+  size_type dropped() const;
+
+private:
+  template <Hashable, class, ProbingPolicy, std::size_t, class>
+  friend class chashmap;
+
+  // with backpressure::block, a push claims the next position and then
+  // publishes its change there once the slot a lap behind has been drained.
+  // a map claims under its lock and may publish after releasing it.
+  size_type claim();
+  // false, leaving c alone, when the slot at pos hasn't been drained yet
+  bool try_publish(size_type pos, change &c);
+  void publish(size_type pos, change c);
+
+  struct slot {
+    std::atomic<size_type> sequence;
+    std::optional<change> content;
+  };
+  std::unique_ptr<slot[]> slots;
+  size_type mask;
+  backpressure full_policy;
+  std::atomic<size_type> dropped_changes{0};
+  // writers waiting for a slot, so that drain only wakes anyone when needed
+  std::atomic<size_type> blocked{0};
+  alignas(64) std::atomic<size_type> tail{0};
+  alignas(64) std::atomic<size_type> head{0};
+};
+
+template <class Key, class T>
+chchangelog<Key, T>::chchangelog(size_type capacity, backpressure policy)
+    : full_policy{policy} {
+  if (capacity == 0) {
+    throw std::runtime_error("a change log needs a capacity");
+  }
+  // with a single slot, a change waiting for a reader would look like room
+  // for the next one
+  size_type rounded = 2;
+  while (rounded < capacity)
+    rounded *= 2;
+  slots = std::make_unique<slot[]>(rounded);
+  mask = rounded - 1;
+  for (size_type i = 0; i < rounded; ++i)
+    slots[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+template <class Key, class T>
+bool chchangelog<Key, T>::push(change c) {
+  if (full_policy == backpressure::block) {
+    publish(claim(), std::move(c));
+    return true;
+  }
+  size_type pos = tail.load(std::memory_order_relaxed);
+  for (;;) {
+    slot &s = slots[pos & mask];
+    const size_type sequence = s.sequence.load(std::memory_order_acquire);
+    const auto lag = (std::ptrdiff_t)(sequence - pos);
+    if (lag == 0) {
+      if (tail.compare_exchange_weak(pos, pos + 1,
+                                     std::memory_order_relaxed)) {
+        s.content.emplace(std::move(c));
+        s.sequence.store(pos + 1, std::memory_order_release);
+        return true;
+      }
+    } else if (lag < 0) {
+      // the slot still holds the change from one lap ago
+      dropped_changes.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    } else {
+      pos = tail.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+template <class Key, class T>
+typename chchangelog<Key, T>::size_type chchangelog<Key, T>::claim() {
+  return tail.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <class Key, class T>
+bool chchangelog<Key, T>::try_publish(size_type pos, change &c) {
+  slot &s = slots[pos & mask];
+  if (s.sequence.load(std::memory_order_acquire) != pos)
+    return false;
+  s.content.emplace(std::move(c));
+  s.sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+template <class Key, class T>
+void chchangelog<Key, T>::publish(size_type pos, change c) {
+  slot &s = slots[pos & mask];
+  // the slot still holds the change from one lap ago, or one claimed then
+  // hasn't been published yet
+  for (size_type sequence = s.sequence.load(std::memory_order_acquire);
+       sequence != pos; sequence = s.sequence.load(std::memory_order_acquire)) {
+    blocked.fetch_add(1);
+    s.sequence.wait(sequence);
+    blocked.fetch_sub(1);
+  }
+  s.content.emplace(std::move(c));
+  s.sequence.store(pos + 1, std::memory_order_release);
+}
+
+template <class Key, class T>
+typename chchangelog<Key, T>::size_type
+chchangelog<Key, T>::drain(std::vector<change> &into, size_type max) {
+  size_type count = 0;
+  size_type pos = head.load(std::memory_order_relaxed);
+  while (count < max) {
+    slot &s = slots[pos & mask];
+    const size_type sequence = s.sequence.load(std::memory_order_acquire);
+    const auto lag = (std::ptrdiff_t)(sequence - (pos + 1));
+    if (lag == 0) {
+      if (head.compare_exchange_weak(pos, pos + 1,
+                                     std::memory_order_relaxed)) {
+        into.push_back(std::move(*s.content));
+        s.content.reset();
+        // free for the writer one lap ahead. seq_cst pairs with the
+        // increment of blocked, a writer either sees this or gets woken
+        s.sequence.store(pos + mask + 1);
+        if (blocked.load() != 0)
+          s.sequence.notify_all();
+        ++pos;
+        ++count;
+      }
+    } else if (lag < 0) {
+      break; // empty
+    } else {
+      pos = head.load(std::memory_order_relaxed);
+    }
+  }
+  return count;
+}
+
+template <class Key, class T>
+constexpr typename chchangelog<Key, T>::size_type
+chchangelog<Key, T>::capacity() const {
+  return mask + 1;
+}
+
+template <class Key, class T>
+constexpr backpressure chchangelog<Key, T>::policy() const {
+  return full_policy;
+}
+
+template <class Key, class T>
+typename chchangelog<Key, T>::size_type chchangelog<Key, T>::dropped() const {
+  return dropped_changes.load(std::memory_order_relaxed);
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+std::shared_ptr<chchangelog<Key, T>>
+chashmap<Key, T, Probing, Inline, Alloc>::enable_change_log(
+    typename chashmap<Key, T, Probing, Inline, Alloc>::size_type capacity,
+    backpressure policy) {
+  auto log = std::make_shared<chchangelog<Key, T>>(capacity, policy);
+  std::unique_lock lock(mutex);
+  changes.log = log;
+  return log;
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing, std::size_t Inline,
+          class Alloc>
+void chashmap<Key, T, Probing, Inline, Alloc>::disable_change_log() {
+  std::unique_lock lock(mutex);
+  changes.log = nullptr;
+}
+
+// a bounded cache on top of chashmap. entries are evicted with the CLOCK
+// algorithm: a hit only sets the entry's reference bit, and the hand that
+// sweeps the ring for a victim clears the bits it passes. large caches are
+// split by key hash into shards, each with a map, a ring and a hand of its
+// own, and every operation runs on the caller's task under the lock of its
+// shard's map: shared for reads, exclusive for writes and evictions. a
+// shard evicts once it is full, even if other shards still have room.
+template <Hashable Key, class T, ProbingPolicy Probing = linear_probing>
+class chcache {
+public:
+  using key_type = Key;
+  using mapped_type = T;
+  using size_type = std::size_t;
+  using clock = std::chrono::steady_clock;
+
+  struct cache_statistics {
+    size_type hits;
+    size_type misses;
+    size_type evictions;
+    size_type loads;
+  };
+
+  // the fewest entries a shard is given, smaller caches keep a single clock
+  static constexpr size_type min_shard_capacity = 1024;
+  static constexpr size_type max_shards = 16;
+
+private:
+  struct entry {
+    const Key key;
+    const T value;
+    const clock::time_point expires;
+    size_type slot;
+    std::atomic<bool> referenced = false;
+
+    entry(Key key, T value, clock::time_point expires, size_type slot)
+        : key{std::move(key)}, value{std::move(value)}, expires{expires},
+          slot{slot} {}
+  };
+  using entry_ptr = std::shared_ptr<entry>;
+
+  struct shard {
+    chashmap<Key, entry_ptr, Probing> entries;
+    // the clock, every entry in entries also sits in ring[entry->slot]. the
+    // ring and the hand only change under the exclusive lock of entries
+    std::vector<entry_ptr> ring;
+    size_type hand = 0;
+
+    // entries is sized so that a full shard stays under the max load factor
+    explicit shard(size_type capacity)
+        : entries{capacity * 2 + 1}, ring(capacity) {}
+  };
+
+  size_type total_capacity;
+  std::vector<std::unique_ptr<shard>> shards;
+  std::uint64_t seed = hash_detail::fresh_seed();
+  std::optional<clock::duration> ttl;
+  // misses that are being loaded, so concurrent misses share one load
+  std::unordered_map<Key, std::shared_future<T>> loading;
+  std::mutex loading_mutex;
+  std::atomic<size_type> hits = 0;
+  std::atomic<size_type> misses = 0;
+  std::atomic<size_type> evictions = 0;
+  std::atomic<size_type> loads = 0;
+
+public:
+  explicit chcache(const size_type capacity,
+                   std::optional<clock::duration> ttl = std::nullopt);
+  chcache(const chcache<Key, T, Probing> &) = delete;
+  chcache<Key, T, Probing> &operator=(const chcache<Key, T, Probing> &) =
+      delete;
+  constexpr size_type capacity() const;
+  constexpr size_type shard_count() const;
+  size_type size() const;
+  cache_statistics stats() const;
+  std::future<std::optional<T>> get(Key key);
+  std::future<void> put(Key key, T value);
+  std::future<size_type> erase(Key key);
+  std::future<T> get_or_load(Key key, std::invocable<const Key &> auto loader);
+
+private:
+  shard &shard_for(const Key &key);
+  // the live value of key, without counting a hit or a miss
+  std::optional<T> peek(const Key &key);
+  std::optional<T> lookup(const Key &key);
+  void store(Key key, T value);
+  size_type remove(const Key &key);
+  // the helpers below expect the caller to hold the shard's exclusive lock.
+  size_type advance_hand(shard &s);
+  constexpr bool expired(const entry &e, clock::time_point now) const;
+};
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+chcache<Key, T, Probing>::chcache(const size_type capacity,
+                                  std::optional<clock::duration> ttl)
+    : total_capacity{capacity}, ttl{ttl} {
+  if (capacity <= 0) {
+    throw std::runtime_error("cache capacity needs to be non-negative");
+  }
+  const size_type count = std::clamp<size_type>(capacity / min_shard_capacity,
+                                                1, max_shards);
+  // the shards' capacities add up to capacity
+  for (size_type i = 0; i < count; ++i)
+    shards.push_back(std::make_unique<shard>(capacity / count +
+                                             (i < capacity % count ? 1 : 0)));
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+constexpr typename chcache<Key, T, Probing>::size_type
+chcache<Key, T, Probing>::capacity() const {
+  return total_capacity;
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+constexpr typename chcache<Key, T, Probing>::size_type
+chcache<Key, T, Probing>::shard_count() const {
+  return shards.size();
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+typename chcache<Key, T, Probing>::size_type
+chcache<Key, T, Probing>::size() const {
+  size_type size = 0;
+  // stores and evictions change a shard's count under its exclusive lock
+  for (auto &s : shards) {
+    std::shared_lock lock(s->entries.mutex);
+    size += s->entries.size();
+  }
+  return size;
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+typename chcache<Key, T, Probing>::cache_statistics
+chcache<Key, T, Probing>::stats() const {
+  return cache_statistics{hits.load(), misses.load(), evictions.load(),
+                          loads.load()};
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+std::future<std::optional<T>> chcache<Key, T, Probing>::get(Key key) {
+  return std::async(std::launch::async,
+                    [&, key = std::move(key)] { return lookup(key); });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+std::future<void> chcache<Key, T, Probing>::put(Key key, T value) {
+  return std::async(std::launch::async,
+                    [&, key = std::move(key), value = std::move(value)] {
+                      store(key, value);
+                    });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+std::future<typename chcache<Key, T, Probing>::size_type>
+chcache<Key, T, Probing>::erase(Key key) {
+  return std::async(std::launch::async,
+                    [&, key = std::move(key)] { return remove(key); });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+std::future<T>
+chcache<Key, T, Probing>::get_or_load(Key key,
+                                      std::invocable<const Key &> auto loader) {
+  return std::async(std::launch::async, [&, key = std::move(key),
+                                         loader = std::move(loader)] {
+    if (auto value = lookup(key))
+      return *value;
+    // the first miss registers a pending load, later misses for the same key
+    // wait on it instead of hitting the backing store again
+    std::promise<T> promise;
+    std::shared_future<T> pending;
+    bool leader = false;
+    {
+      std::lock_guard lock(loading_mutex);
+      auto [iter, inserted] = loading.try_emplace(key);
+      if (inserted) {
+        iter->second = promise.get_future().share();
+        leader = true;
+      }
+      pending = iter->second;
+    }
+    if (leader) {
+      try {
+        // a load that was pending when we missed may have stored the key and
+        // unregistered since
+        if (auto value = peek(key)) {
+          promise.set_value(std::move(*value));
+        } else {
+          T loaded = loader(key);
+          ++loads;
+          store(key, loaded);
+          promise.set_value(std::move(loaded));
+        }
+      } catch (...) {
+        promise.set_exception(std::current_exception());
+      }
+      std::lock_guard lock(loading_mutex);
+      loading.erase(key);
+    }
+    return pending.get();
+  });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+typename chcache<Key, T, Probing>::shard &
+chcache<Key, T, Probing>::shard_for(const Key &key) {
+  // the high half, the shard's map places keys by the low bits of its own hash
+  return *shards[(seeded_hash<Key>()(key, seed) >> 32) % shards.size()];
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+std::optional<T> chcache<Key, T, Probing>::peek(const Key &key) {
+  shard &s = shard_for(key);
+  std::shared_lock lock(s.entries.mutex);
+  auto idx = s.entries.locate(key);
+  if (!idx)
+    return std::nullopt;
+  entry &found = *s.entries.buckets[*idx]->second.second;
+  if (expired(found, clock::now()))
+    return std::nullopt;
+  found.referenced.store(true, std::memory_order_relaxed);
+  return found.value;
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+std::optional<T> chcache<Key, T, Probing>::lookup(const Key &key) {
+  auto value = peek(key);
+  if (value)
+    ++hits;
+  else
+    ++misses;
+  return value;
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+void chcache<Key, T, Probing>::store(Key key, T value) {
+  shard &s = shard_for(key);
+  std::unique_lock lock(s.entries.mutex);
+  size_type slot;
+  if (auto idx = s.entries.locate(key)) {
+    // replace the entry in place, it keeps its position on the clock
+    slot = s.entries.buckets[*idx]->second.second->slot;
+  } else {
+    slot = advance_hand(s);
+    if (s.ring[slot] != nullptr) {
+      s.entries.erase_locked(s.ring[slot]->key);
+      ++evictions;
+    }
+  }
+  auto expires = ttl ? clock::now() + *ttl : clock::time_point::max();
+  s.ring[slot] =
+      std::make_shared<entry>(std::move(key), std::move(value), expires, slot);
+  s.entries.insert_or_assign_locked(s.ring[slot]->key, s.ring[slot]);
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+typename chcache<Key, T, Probing>::size_type
+chcache<Key, T, Probing>::remove(const Key &key) {
+  shard &s = shard_for(key);
+  std::unique_lock lock(s.entries.mutex);
+  auto idx = s.entries.locate(key);
+  if (!idx)
+    return 0;
+  s.ring[s.entries.buckets[*idx]->second.second->slot] = nullptr;
+  return s.entries.erase_locked(key);
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+typename chcache<Key, T, Probing>::size_type
+chcache<Key, T, Probing>::advance_hand(shard &s) {
+  const auto now = clock::now();
+  for (;;) {
+    size_type slot = s.hand;
+    s.hand = (s.hand + 1) % s.ring.size();
+    const entry_ptr &e = s.ring[slot];
+    // an empty or expired slot is free, anything else that was read since the
+    // hand last passed gets a second chance
+    if (e == nullptr || expired(*e, now) ||
+        !e->referenced.exchange(false, std::memory_order_relaxed))
+      return slot;
+  }
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+constexpr bool chcache<Key, T, Probing>::expired(const entry &e,
+                                                 clock::time_point now) const {
+  return e.expires <= now;
+}
+
+// the cpus of every numa node, as reported by sysfs. machines without numa
+// information are treated as a single node holding every cpu.
+struct numa_topology {
+  std::vector<std::vector<int>> nodes;
+
+  static numa_topology detect();
+  // splits the detected cpus round robin into the given number of nodes, to
+  // exercise node placement on machines that only have one
+  static numa_topology simulated(std::size_t node_count);
+  std::size_t node_count() const;
+  // the node of the cpu the calling thread runs on, 0 if it is unknown
+  std::size_t current_node() const;
+  // restricts the calling thread to the cpus of node, false if not supported
+  bool pin(std::size_t node) const;
+};
+
+inline numa_topology numa_topology::detect() {
+  numa_topology topology;
+#ifdef __linux__
+  for (std::size_t node = 0;; ++node) {
+    std::ifstream cpulist("/sys/devices/system/node/node" +
+                          std::to_string(node) + "/cpulist");
+    if (!cpulist)
+      break;
+    // a comma separated list of cpus and cpu ranges, e.g. 0-3,8-11
+    std::vector<int> cpus;
+    int first, last;
+    while (cpulist >> first) {
+      last = first;
+      if (cpulist.peek() == '-') {
+        cpulist.get();
+        cpulist >> last;
+      }
+      for (int cpu = first; cpu <= last; ++cpu)
+        cpus.push_back(cpu);
+      if (cpulist.peek() == ',')
+        cpulist.get();
+    }
+    if (!cpus.empty())
+      topology.nodes.push_back(std::move(cpus));
+  }
+#endif
+  if (topology.nodes.empty()) {
+    std::vector<int> cpus(std::max(1u, std::thread::hardware_concurrency()));
+    for (std::size_t cpu = 0; cpu < cpus.size(); ++cpu)
+      cpus[cpu] = cpu;
+    topology.nodes.push_back(std::move(cpus));
+  }
+  return topology;
+}
+
+inline numa_topology numa_topology::simulated(std::size_t node_count) {
+  if (node_count <= 0) {
+    throw std::runtime_error("node count needs to be non-negative");
+  }
+  std::vector<int> cpus;
+  for (auto &node : detect().nodes)
+    cpus.insert(cpus.end(), node.begin(), node.end());
+  numa_topology topology;
+  topology.nodes.resize(node_count);
+  // with fewer cpus than nodes, the nodes share cpus
+  for (std::size_t i = 0; i < std::max(cpus.size(), node_count); ++i)
+    topology.nodes[i % node_count].push_back(cpus[i % cpus.size()]);
+  return topology;
+}
+
+inline std::size_t numa_topology::node_count() const { return nodes.size(); }
+
+inline std::size_t numa_topology::current_node() const {
+#ifdef __linux__
+  int cpu = sched_getcpu();
+  for (std::size_t node = 0; node < nodes.size(); ++node)
+    if (std::find(nodes[node].begin(), nodes[node].end(), cpu) !=
+        nodes[node].end())
+      return node;
+#endif
+  return 0;
+}
+
+inline bool numa_topology::pin(std::size_t node) const {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : nodes.at(node))
+    CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void)node;
+  return false;
+#endif
+}
+
+// allocates on a thread pinned to a numa node and zeroes the memory there, so
+// that first touch places it in the node's local memory. chshardedmap gives
+// one to each shard for its bucket arrays. without a topology, it allocates
+// like std::allocator.
+template <class T> class numa_allocator {
+public:
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  numa_allocator() = default;
+  numa_allocator(std::shared_ptr<const numa_topology> topology,
+                 std::size_t node);
+  template <class U> numa_allocator(const numa_allocator<U> &other);
+  T *allocate(std::size_t n);
+  void deallocate(T *p, std::size_t n);
+  template <class U> bool operator==(const numa_allocator<U> &other) const;
+
+private:
+  template <class> friend class numa_allocator;
+  std::shared_ptr<const numa_topology> topology;
+  std::size_t node = 0;
+};
+
+template <class T>
+numa_allocator<T>::numa_allocator(
+    std::shared_ptr<const numa_topology> topology, std::size_t node)
+    : topology{std::move(topology)}, node{node} {}
+
+template <class T>
+template <class U>
+numa_allocator<T>::numa_allocator(const numa_allocator<U> &other)
+    : topology{other.topology}, node{other.node} {}
+
+template <class T> T *numa_allocator<T>::allocate(std::size_t n) {
+  if (topology == nullptr)
+    return std::allocator<T>().allocate(n);
+  T *p = nullptr;
+  std::exception_ptr error;
+  std::thread([&] {
+    topology->pin(node);
+    try {
+      p = std::allocator<T>().allocate(n);
+      std::memset((void *)p, 0, n * sizeof(T));
+    } catch (...) {
+      error = std::current_exception();
+    }
+  }).join();
+  if (error)
+    std::rethrow_exception(error);
+  return p;
+}
+
+template <class T> void numa_allocator<T>::deallocate(T *p, std::size_t n) {
+  std::allocator<T>().deallocate(p, n);
+}
+
+template <class T>
+template <class U>
+bool numa_allocator<T>::operator==(const numa_allocator<U> &other) const {
+  // any of them can free what another allocated
+  (void)other;
+  return true;
+}
+
+// a chashmap split into independent shards, shards_per_node of them for every
+// numa node. a shard's bucket arrays, the first and every one it grows into,
+// come from a numa_allocator for its node, so they live in the node's local
+// memory. entries are allocated by the thread that inserts them. keys are
+// spread over every shard by hash, unless a node hint routes them to the shards
+// of a particular node; threads working on a partitioned key space can then be
+// pinned next to their partition.
+template <Hashable Key, class T, ProbingPolicy Probing = linear_probing>
+class chshardedmap {
+public:
+  using map_type = chashmap<Key, T, Probing, 0, numa_allocator<std::byte>>;
+  using key_type = Key;
+  using size_type = std::size_t;
+  using node_hint = std::function<size_type(const Key &)>;
+
+private:
+  numa_topology topology;
+  size_type shards_per_node;
+  // node major, the shards of node n start at n * shards_per_node
+  std::vector<std::unique_ptr<map_type>> shards;
+  node_hint hint;
+  // keys are routed by a hash of their own, so that keys can't be picked to
+  // land in one shard
+  std::uint64_t seed = hash_detail::fresh_seed();
+
+public:
+  explicit chshardedmap(const size_type shards_per_node = 4,
+                        const size_type initial_capacity = 16,
+                        node_hint hint = {},
+                        numa_topology topology = numa_topology::detect());
+  constexpr size_type node_count() const;
+  constexpr size_type shard_count() const;
+  constexpr size_type node_of_shard(size_type shard) const;
+  size_type shard_index(const Key &key) const;
+  map_type &shard(size_type shard);
+  map_type &shard_for(const Key &key);
+  const numa_topology &nodes() const;
+  size_type size() const;
+  void clear();
+  std::future<std::pair<typename map_type::iterator, bool>> insert(Key key,
+                                                                   T value);
+  std::future<std::pair<typename map_type::iterator, bool>>
+  insert_or_assign(Key key, T value);
+  std::future<size_type> erase(Key key);
+  std::future<bool> contains(Key key);
+  std::future<T *> get(Key key);
+  T &operator[](const Key &key);
+  std::future<T &> merge(Key key, T value,
+                         std::invocable<const T &, const T &> auto fn);
+  // one change log per shard, indexed like shard(), so that writers to
+  // different shards never push to the same ring. each log keeps the order
+  // of its own shard's changes.
+  std::vector<std::shared_ptr<chchangelog<Key, T>>>
+  enable_change_log(size_type capacity = 4096,
+                    backpressure policy = backpressure::block);
+  void disable_change_log();
+};
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+chshardedmap<Key, T, Probing>::chshardedmap(const size_type shards_per_node,
+                                            const size_type initial_capacity,
+                                            node_hint hint,
+                                            numa_topology topology)
+    : topology{std::move(topology)}, shards_per_node{shards_per_node},
+      shards(this->topology.node_count() * shards_per_node),
+      hint{std::move(hint)} {
+  if (shards_per_node <= 0) {
+    throw std::runtime_error("shards per node needs to be non-negative");
+  }
+  // with a single node there is nothing to place, and first touch from here
+  // is as good as anywhere
+  auto placement = node_count() == 1
+                       ? nullptr
+                       : std::make_shared<const numa_topology>(this->topology);
+  for (size_type shard = 0; shard < shards.size(); ++shard)
+    shards[shard] = std::make_unique<map_type>(
+        initial_capacity,
+        numa_allocator<std::byte>(placement, node_of_shard(shard)));
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+constexpr typename chshardedmap<Key, T, Probing>::size_type
+chshardedmap<Key, T, Probing>::node_count() const {
+  return topology.node_count();
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+constexpr typename chshardedmap<Key, T, Probing>::size_type
+chshardedmap<Key, T, Probing>::shard_count() const {
+  return shards.size();
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+constexpr typename chshardedmap<Key, T, Probing>::size_type
+chshardedmap<Key, T, Probing>::node_of_shard(size_type shard) const {
+  return shard / shards_per_node;
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+typename chshardedmap<Key, T, Probing>::size_type
+chshardedmap<Key, T, Probing>::shard_index(const Key &key) const {
+  // the high half, the shard places keys by the low bits of its own hash
+  const size_type mixed = seeded_hash<Key>()(key, seed) >> 32;
+  if (hint)
+    return (hint(key) % node_count()) * shards_per_node +
+           mixed % shards_per_node;
+  return mixed % shards.size();
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+typename chshardedmap<Key, T, Probing>::map_type &
+chshardedmap<Key, T, Probing>::shard(size_type shard) {
+  return *shards.at(shard);
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+typename chshardedmap<Key, T, Probing>::map_type &
+chshardedmap<Key, T, Probing>::shard_for(const Key &key) {
+  return *shards[shard_index(key)];
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+const numa_topology &chshardedmap<Key, T, Probing>::nodes() const {
+  return topology;
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+typename chshardedmap<Key, T, Probing>::size_type
+chshardedmap<Key, T, Probing>::size() const {
+  size_type size = 0;
+  for (auto &shard : shards)
+    size += shard->size();
+  return size;
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+void chshardedmap<Key, T, Probing>::clear() {
+  for (auto &shard : shards)
+    shard->clear();
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+std::vector<std::shared_ptr<chchangelog<Key, T>>>
+chshardedmap<Key, T, Probing>::enable_change_log(size_type capacity,
+                                                 backpressure policy) {
+  std::vector<std::shared_ptr<chchangelog<Key, T>>> logs;
+  logs.reserve(shards.size());
+  for (auto &shard : shards)
+    logs.push_back(shard->enable_change_log(capacity, policy));
+  return logs;
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+void chshardedmap<Key, T, Probing>::disable_change_log() {
+  for (auto &shard : shards)
+    shard->disable_change_log();
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+std::future<
+    std::pair<typename chshardedmap<Key, T, Probing>::map_type::iterator, bool>>
+chshardedmap<Key, T, Probing>::insert(Key key, T value) {
+  auto &map = shard_for(key);
+  return map.insert(std::move(key), std::move(value));
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+std::future<
+    std::pair<typename chshardedmap<Key, T, Probing>::map_type::iterator, bool>>
+chshardedmap<Key, T, Probing>::insert_or_assign(Key key, T value) {
+  auto &map = shard_for(key);
+  return map.insert_or_assign(std::move(key), std::move(value));
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+std::future<typename chshardedmap<Key, T, Probing>::size_type>
+chshardedmap<Key, T, Probing>::erase(Key key) {
+  auto &map = shard_for(key);
+  return map.erase(std::move(key));
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+std::future<bool> chshardedmap<Key, T, Probing>::contains(Key key) {
+  auto &map = shard_for(key);
+  return map.contains(std::move(key));
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+std::future<T *> chshardedmap<Key, T, Probing>::get(Key key) {
+  auto &map = shard_for(key);
+  return map.get(std::move(key));
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+T &chshardedmap<Key, T, Probing>::operator[](const Key &key) {
+  return shard_for(key)[key];
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+std::future<T &> chshardedmap<Key, T, Probing>::merge(
+    Key key, T value, std::invocable<const T &, const T &> auto fn) {
+  auto &map = shard_for(key);
+  return map.merge(std::move(key), std::move(value), std::move(fn));
+}
+
+// a set on the chashmap engine. buckets hold the key alone, so a set costs
+// no more per entry than the key itself.
+template <Hashable Key, ProbingPolicy Probing = linear_probing>
+class chashset : public chashtable<Key, const Key, Probing> {
+  using base = chashtable<Key, const Key, Probing>;
+  using base::buckets;
+  using base::is_tombstone;
+  using base::locate;
+  using base::mutex;
+  using base::remove_at;
+  using base::scan_start;
+  using base::reserve_for_insert;
+  using base::shrink_after_erase;
+  using base::try_place;
+
+public:
+  using typename base::const_iterator;
+  using typename base::difference_type;
+  using typename base::iterator;
+  using typename base::key_type;
+  using typename base::size_type;
+  using typename base::value_type;
+  using base::begin;
+  using base::cbegin;
+  using base::cend;
+  using base::end;
+  using base::erase;
+
+  constexpr chashset(const size_type initial_capacity = 16);
+  std::future<std::pair<iterator, bool>> insert(Key key);
+  std::future<size_type> erase(Key key);
+  std::future<size_type> count(Key key) const;
+  std::future<iterator> find(Key key);
+  std::future<const_iterator> find(Key key) const;
+  std::future<bool> contains(Key key) const;
+  std::future<size_type> erase_if(std::predicate<const Key &> auto fn);
+  std::future<size_type> count_if(std::predicate<const Key &> auto fn) const;
+
+  auto async_insert(Key key);
+  auto async_insert(Key key, Scheduler auto &scheduler);
+  auto async_erase(Key key);
+  auto async_erase(Key key, Scheduler auto &scheduler);
+  auto async_contains(Key key) const;
+  auto async_contains(Key key, Scheduler auto &scheduler) const;
+
+private:
+  // the helpers below expect the caller to already hold the mutex.
+  std::pair<iterator, bool> insert_locked(Key key);
+  size_type erase_locked(const Key &key);
+};
+
+template <Hashable Key, ProbingPolicy Probing>
+constexpr chashset<Key, Probing>::chashset(
+    const typename chashset<Key, Probing>::size_type initial_capacity)
+    : base{initial_capacity} {}
+
+template <Hashable Key, ProbingPolicy Probing>
+std::future<std::pair<typename chashset<Key, Probing>::iterator, bool>>
+chashset<Key, Probing>::insert(Key key) {
+  return std::async(std::launch::async, [&, key = std::move(key)] {
+    std::unique_lock lock(mutex);
+    return insert_locked(key);
+  });
+}
+
+template <Hashable Key, ProbingPolicy Probing>
+std::future<typename chashset<Key, Probing>::size_type>
+chashset<Key, Probing>::erase(Key key) {
+  return std::async(std::launch::async, [&, key = std::move(key)] {
+    std::unique_lock lock(mutex);
+    return erase_locked(key);
+  });
+}
+
+template <Hashable Key, ProbingPolicy Probing>
+std::future<typename chashset<Key, Probing>::size_type>
+chashset<Key, Probing>::count(Key key) const {
+  return std::async(std::launch::async, [&, key = std::move(key)] {
+    std::shared_lock lock(mutex);
+    return locate(key) ? size_type{1} : size_type{0};
+  });
+}
+
+template <Hashable Key, ProbingPolicy Probing>
+std::future<typename chashset<Key, Probing>::iterator>
+chashset<Key, Probing>::find(Key key) {
+  return std::async(std::launch::async, [&, key = std::move(key)] {
+    std::shared_lock lock(mutex);
+    auto idx = locate(key);
+    if (!idx)
+      return end();
+    return iterator(buckets.begin() + *idx, *idx, buckets.size());
+  });
+}
+
+template <Hashable Key, ProbingPolicy Probing>
+std::future<typename chashset<Key, Probing>::const_iterator>
+chashset<Key, Probing>::find(Key key) const {
+  return std::async(std::launch::async, [&, key = std::move(key)] {
+    std::shared_lock lock(mutex);
+    auto idx = locate(key);
+    if (!idx)
+      return cend();
+    return const_iterator(buckets.cbegin() + *idx, *idx, buckets.size());
+  });
+}
+
+template <Hashable Key, ProbingPolicy Probing>
+std::future<bool> chashset<Key, Probing>::contains(Key key) const {
+  return std::async(std::launch::async, [&, key = std::move(key)] {
+    std::shared_lock lock(mutex);
+    return locate(key).has_value();
+  });
+}
+
+template <Hashable Key, ProbingPolicy Probing>
+std::future<typename chashset<Key, Probing>::size_type>
+chashset<Key, Probing>::erase_if(std::predicate<const Key &> auto fn) {
+  return std::async(std::launch::async, [&, fn = std::move(fn)] {
+    std::unique_lock lock(mutex);
+    size_type count = 0;
+    const size_type start = scan_start();
+    for (size_type step = 0; step < buckets.size();) {
+      const size_type idx = (start + step) % buckets.size();
+      const auto &b = buckets[idx];
+      if (b != nullptr && !is_tombstone(b) && fn(b->second)) {
+        remove_at(idx);
+        count++;
+        // a backward shift pulled the next entry into this bucket
+        if constexpr (std::is_same_v<Probing, robin_hood_probing>)
+          continue;
+      }
+      ++step;
+    }
+    shrink_after_erase();
+    return count;
+  });
+}
+
+template <Hashable Key, ProbingPolicy Probing>
+std::future<typename chashset<Key, Probing>::size_type>
+chashset<Key, Probing>::count_if(std::predicate<const Key &> auto fn) const {
+  return std::async(std::launch::async, [&, fn = std::move(fn)] {
+    std::shared_lock lock(mutex);
+    size_type count = 0;
+    for (const Key &key : *this) {
+      if (fn(key)) {
+        count++;
+      }
+    }
+    return count;
+  });
+}
+
+template <Hashable Key, ProbingPolicy Probing>
+auto chashset<Key, Probing>::async_insert(Key key) {
+  static inline_scheduler scheduler;
+  return async_insert(std::move(key), scheduler);
+}
+
+template <Hashable Key, ProbingPolicy Probing>
+auto chashset<Key, Probing>::async_insert(Key key,
+                                          Scheduler auto &scheduler) {
+  return this->template make_awaitable<std::unique_lock<table_mutex>>(
+      mutex, [this, key = std::move(key)] { return insert_locked(key); },
+      scheduler);
+}
+
+template <Hashable Key, ProbingPolicy Probing>
+auto chashset<Key, Probing>::async_erase(Key key) {
+  static inline_scheduler scheduler;
+  return async_erase(std::move(key), scheduler);
+}
+
+template <Hashable Key, ProbingPolicy Probing>
+auto chashset<Key, Probing>::async_erase(Key key, Scheduler auto &scheduler) {
+  return this->template make_awaitable<std::unique_lock<table_mutex>>(
+      mutex, [this, key = std::move(key)] { return erase_locked(key); },
+      scheduler);
+}
+
+template <Hashable Key, ProbingPolicy Probing>
+auto chashset<Key, Probing>::async_contains(Key key) const {
+  static inline_scheduler scheduler;
+  return async_contains(std::move(key), scheduler);
+}
+
+template <Hashable Key, ProbingPolicy Probing>
+auto chashset<Key, Probing>::async_contains(Key key,
+                                            Scheduler auto &scheduler) const {
+  return this->template make_awaitable<std::shared_lock<table_mutex>>(
+      mutex, [this, key = std::move(key)] { return locate(key).has_value(); },
+      scheduler);
+}
+
+template <Hashable Key, ProbingPolicy Probing>
+std::pair<typename chashset<Key, Probing>::iterator, bool>
+chashset<Key, Probing>::insert_locked(Key key) {
+  reserve_for_insert();
+  auto [idx, inserted] = try_place(key, std::move(key));
+  return std::make_pair(iterator(buckets.begin() + idx, idx, buckets.size()),
+                        inserted);
+}
+
+template <Hashable Key, ProbingPolicy Probing>
+typename chashset<Key, Probing>::size_type
+chashset<Key, Probing>::erase_locked(const Key &key) {
+  auto idx = locate(key);
+  if (!idx)
+    return 0;
+  remove_at(*idx);
+  shrink_after_erase();
+  return 1;
+}
+
+// the values of one chmultimap key. appends are a compare and swap on the
+// head of a singly linked list, so any number of threads can append to the
+// same key while holding only the shared table lock.
+template <class T> class chvaluelist {
+private:
+  struct node {
+    T value;
+    node *next;
+  };
+  std::atomic<node *> head = nullptr;
+  std::atomic<std::size_t> length = 0;
+
+public:
+  chvaluelist() = default;
+  chvaluelist(const chvaluelist<T> &) = delete;
+  chvaluelist<T> &operator=(const chvaluelist<T> &) = delete;
+  // takes over the values of a list no other thread is appending to
+  chvaluelist(chvaluelist<T> &&move);
+  ~chvaluelist();
+  void push(T value);
+  std::size_t size() const;
+  // the values in the order they were appended
+  std::vector<T> values() const;
+};
+
+template <class T>
+chvaluelist<T>::chvaluelist(chvaluelist<T> &&move)
+    : head(move.head.exchange(nullptr, std::memory_order_acq_rel)),
+      length(move.length.exchange(0, std::memory_order_relaxed)) {}
+
+template <class T> chvaluelist<T>::~chvaluelist() {
+  for (node *n = head.load(std::memory_order_acquire); n != nullptr;) {
+    delete std::exchange(n, n->next);
+  }
+}
+
+template <class T> void chvaluelist<T>::push(T value) {
+  node *n = new node{std::move(value), head.load(std::memory_order_relaxed)};
+  while (!head.compare_exchange_weak(n->next, n, std::memory_order_release,
+                                     std::memory_order_relaxed))
+    ;
+  length.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <class T> std::size_t chvaluelist<T>::size() const {
+  return length.load(std::memory_order_relaxed);
+}
+
+template <class T> std::vector<T> chvaluelist<T>::values() const {
+  std::vector<T> result;
+  for (node *n = head.load(std::memory_order_acquire); n != nullptr;
+       n = n->next)
+    result.push_back(n->value);
+  std::reverse(result.begin(), result.end());
+  return result;
+}
+
+// a multimap on the chashmap engine. the table lock is only taken exclusively
+// to add or remove a key; appending to a key that is already present holds
+// the shared lock, and appends to the same key don't serialize on each other.
+template <Hashable Key, class T, ProbingPolicy Probing = linear_probing>
+class chmultimap
+    : public chashtable<Key, std::pair<const Key, chvaluelist<T>>, Probing> {
+  using base = chashtable<Key, std::pair<const Key, chvaluelist<T>>, Probing>;
+  using base::buckets;
+  using base::locate;
+  using base::mutex;
+  using base::remove_at;
+  using base::reserve_for_insert;
+  using base::shrink_after_erase;
+  using base::try_place;
+
+public:
+  using typename base::const_iterator;
+  using typename base::difference_type;
+  using typename base::iterator;
+  using typename base::key_type;
+  using typename base::size_type;
+  using typename base::value_type;
+  using base::begin;
+  using base::cbegin;
+  using base::cend;
+  using base::end;
+  using base::erase;
+
+  constexpr chmultimap(const size_type initial_capacity = 16);
+  // value lists are shared between appending threads and can't be copied, so
+  // neither can a multimap. it can be moved.
+  chmultimap(const chmultimap<Key, T, Probing> &) = delete;
+  chmultimap(chmultimap<Key, T, Probing> &&) = default;
+  chmultimap<Key, T, Probing> &
+  operator=(const chmultimap<Key, T, Probing> &) = delete;
+  std::future<void> insert(Key key, T value);
+  std::future<std::vector<T>> get(Key key) const;
+  // the number of values stored under key
+  std::future<size_type> count(Key key) const;
+  std::future<bool> contains(Key key) const;
+  // removes key and all of its values, returning how many values there were
+  std::future<size_type> erase(Key key);
+
+  auto async_insert(Key key, T value);
+  auto async_insert(Key key, T value, Scheduler auto &scheduler);
+  auto async_get(Key key) const;
+  auto async_get(Key key, Scheduler auto &scheduler) const;
+
+private:
+  // the helpers below expect the caller to already hold the mutex.
+  bool append_locked(const Key &key, T &value);
+  void insert_locked(Key key, T value);
+  size_type erase_locked(const Key &key);
+  std::vector<T> get_locked(const Key &key) const;
+};
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+constexpr chmultimap<Key, T, Probing>::chmultimap(
+    const typename chmultimap<Key, T, Probing>::size_type initial_capacity)
+    : base{initial_capacity} {}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+std::future<void> chmultimap<Key, T, Probing>::insert(Key key, T value) {
+  return std::async(std::launch::async, [&, key = std::move(key),
+                                         value = std::move(value)]() mutable {
+    {
+      std::shared_lock lock(mutex);
+      if (append_locked(key, value))
+        return;
+    }
+    std::unique_lock lock(mutex);
+    insert_locked(std::move(key), std::move(value));
+  });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+std::future<std::vector<T>> chmultimap<Key, T, Probing>::get(Key key) const {
+  return std::async(std::launch::async, [&, key = std::move(key)] {
+    std::shared_lock lock(mutex);
+    return get_locked(key);
+  });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+std::future<typename chmultimap<Key, T, Probing>::size_type>
+chmultimap<Key, T, Probing>::count(Key key) const {
+  return std::async(std::launch::async, [&, key = std::move(key)] {
+    std::shared_lock lock(mutex);
+    auto idx = locate(key);
+    return idx ? buckets[*idx]->second.second.size() : size_type{0};
+  });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+std::future<bool> chmultimap<Key, T, Probing>::contains(Key key) const {
+  return std::async(std::launch::async, [&, key = std::move(key)] {
+    std::shared_lock lock(mutex);
+    return locate(key).has_value();
+  });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+std::future<typename chmultimap<Key, T, Probing>::size_type>
+chmultimap<Key, T, Probing>::erase(Key key) {
+  return std::async(std::launch::async, [&, key = std::move(key)] {
+    std::unique_lock lock(mutex);
+    return erase_locked(key);
+  });
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+auto chmultimap<Key, T, Probing>::async_insert(Key key, T value) {
+  static inline_scheduler scheduler;
+  return async_insert(std::move(key), std::move(value), scheduler);
+}
+
+// the awaitable holds a single lock for its whole operation, so unlike
+// insert() this always takes the exclusive lock.
+template <Hashable Key, class T, ProbingPolicy Probing>
+auto chmultimap<Key, T, Probing>::async_insert(Key key, T value,
+                                               Scheduler auto &scheduler) {
+  return this->template make_awaitable<std::unique_lock<table_mutex>>(
+      mutex,
+      [this, key = std::move(key), value = std::move(value)] {
+        insert_locked(key, value);
+        return true;
+      },
+      scheduler);
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+auto chmultimap<Key, T, Probing>::async_get(Key key) const {
+  static inline_scheduler scheduler;
+  return async_get(std::move(key), scheduler);
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+auto chmultimap<Key, T, Probing>::async_get(Key key,
+                                            Scheduler auto &scheduler) const {
+  return this->template make_awaitable<std::shared_lock<table_mutex>>(
+      mutex, [this, key = std::move(key)] { return get_locked(key); },
+      scheduler);
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+bool chmultimap<Key, T, Probing>::append_locked(const Key &key, T &value) {
+  auto idx = locate(key);
+  if (!idx)
+    return false;
+  buckets[*idx]->second.second.push(std::move(value));
+  return true;
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+void chmultimap<Key, T, Probing>::insert_locked(Key key, T value) {
+  // another writer may have added the key since the shared lock was released
+  if (append_locked(key, value))
+    return;
+  reserve_for_insert();
+  auto [idx, inserted] = try_place(key, std::piecewise_construct,
+                                   std::forward_as_tuple(std::move(key)),
+                                   std::forward_as_tuple());
+  buckets[idx]->second.second.push(std::move(value));
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+typename chmultimap<Key, T, Probing>::size_type
+chmultimap<Key, T, Probing>::erase_locked(const Key &key) {
+  auto idx = locate(key);
+  if (!idx)
+    return 0;
+  size_type count = buckets[*idx]->second.second.size();
+  remove_at(*idx);
+  shrink_after_erase();
+  return count;
+}
+
+template <Hashable Key, class T, ProbingPolicy Probing>
+std::vector<T> chmultimap<Key, T, Probing>::get_locked(const Key &key) const {
+  auto idx = locate(key);
+  if (!idx)
+    return {};
+  return buckets[*idx]->second.second.values();
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,385 @@
+// randomized concurrent histories against a single chashmap, checked key by
+// key for linearizability against a sequential model of the map. every
+// thread's operations come from its own seeded generator, so a seed
+// reproduces the same operations; the interleaving is up to the scheduler.
+//
+// usage: ./stress [--threads N] [--ops N] [--keys N] [--rounds N]
+//                 [--seed N] [--api future|await] [--probing linear|robin]
+//
+// each round prints a row of a markdown table with its throughput, so a run
+// with many threads on few keys doubles as a contention benchmark. exits
+// with 1 and prints the offending key's history when a check fails.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <latch>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "chashmap.h"
+
+struct options {
+  std::size_t threads = 4;
+  std::size_t ops = 20000;
+  int keys = 64;
+  std::size_t rounds = 5;
+  std::uint64_t seed = 411;
+  bool await = false;
+  bool robin_hood = false;
+};
+
+enum class op_kind { insert, erase, get, merge };
+
+struct operation {
+  op_kind kind;
+  int key;
+  // the argument of insert and merge
+  std::int64_t value;
+  // ticks of a clock shared by all threads, taken right before the call and
+  // right after it returned
+  std::uint64_t invoked;
+  std::uint64_t returned;
+  // the response
+  bool inserted = false;
+  std::size_t erased = 0;
+  std::optional<std::int64_t> got;
+  std::int64_t merged = 0;
+};
+
+static std::int64_t sum(const std::int64_t &value, const std::int64_t &old) {
+  return value + old;
+}
+
+// the sequential model: the value under one key, if there is one. returns
+// whether the response is what the model answers, and the next state.
+static std::pair<bool, std::optional<std::int64_t>>
+step(const std::optional<std::int64_t> &state, const operation &op) {
+  switch (op.kind) {
+  case op_kind::insert:
+    return {op.inserted == !state, state ? state : op.value};
+  case op_kind::erase:
+    return {op.erased == (state ? 1u : 0u), std::nullopt};
+  case op_kind::get:
+    return {op.got == state, state};
+  case op_kind::merge: {
+    std::int64_t merged = state ? sum(op.value, *state) : op.value;
+    return {op.merged == merged, merged};
+  }
+  }
+  return {false, state};
+}
+
+struct checked_state {
+  std::vector<std::uint64_t> linearized;
+  std::optional<std::int64_t> value;
+  bool operator==(const checked_state &) const = default;
+};
+
+struct checked_state_hash {
+  std::size_t operator()(const checked_state &s) const {
+    std::size_t hash = s.value ? std::hash<std::int64_t>()(*s.value) : 1;
+    for (auto word : s.linearized)
+      hash = hash * 0x9E3779B97F4A7C15ull ^ std::hash<std::uint64_t>()(word);
+    return hash;
+  }
+};
+
+// the Wing & Gong search with Lowe's memoization: linearize calls in real
+// time order, backtrack at a return whose call couldn't be linearized yet,
+// and never revisit a set of linearized operations with the same state.
+static bool linearizable(const std::vector<const operation *> &ops) {
+  struct entry {
+    std::size_t op;
+    bool call;
+    std::uint64_t time;
+  };
+  std::vector<entry> entries;
+  for (std::size_t i = 0; i < ops.size(); ++i) {
+    entries.push_back({i, true, ops[i]->invoked});
+    entries.push_back({i, false, ops[i]->returned});
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const entry &a, const entry &b) { return a.time < b.time; });
+
+  // a circular doubly linked list over entries, with head as its sentinel
+  const std::size_t head = entries.size();
+  std::vector<std::size_t> next(entries.size() + 1), prev(entries.size() + 1);
+  std::vector<std::size_t> return_of(ops.size());
+  for (std::size_t e = 0; e <= entries.size(); ++e) {
+    next[e] = e == entries.size() ? 0 : e + 1;
+    prev[e] = e == 0 ? head : e - 1;
+    if (e < entries.size() && !entries[e].call)
+      return_of[entries[e].op] = e;
+  }
+  if (entries.empty())
+    return true;
+  auto unlink = [&](std::size_t e) {
+    next[prev[e]] = next[e];
+    prev[next[e]] = prev[e];
+  };
+  auto relink = [&](std::size_t e) {
+    next[prev[e]] = e;
+    prev[next[e]] = e;
+  };
+
+  checked_state current{std::vector<std::uint64_t>((ops.size() + 63) / 64),
+                        std::nullopt};
+  std::unordered_set<checked_state, checked_state_hash> seen;
+  std::vector<std::pair<std::size_t, std::optional<std::int64_t>>> stack;
+  std::size_t e = next[head];
+  while (next[head] != head) {
+    const std::size_t op = entries[e].op;
+    if (entries[e].call) {
+      auto [ok, value] = step(current.value, *ops[op]);
+      if (ok) {
+        auto candidate = current;
+        candidate.linearized[op / 64] |= 1ull << (op % 64);
+        candidate.value = value;
+        if (seen.insert(candidate).second) {
+          stack.emplace_back(e, current.value);
+          current = std::move(candidate);
+          unlink(e);
+          unlink(return_of[op]);
+          e = next[head];
+          continue;
+        }
+      }
+      e = next[e];
+    } else {
+      // the return of an operation that isn't linearized yet
+      if (stack.empty())
+        return false;
+      auto [call, value] = stack.back();
+      stack.pop_back();
+      const std::size_t undone = entries[call].op;
+      current.linearized[undone / 64] &= ~(1ull << (undone % 64));
+      current.value = value;
+      relink(return_of[undone]);
+      relink(call);
+      e = next[call];
+    }
+  }
+  return true;
+}
+
+struct detached_task {
+  struct promise_type {
+    detached_task get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+template <class Map>
+static void call(Map &map, operation &op) {
+  switch (op.kind) {
+  case op_kind::insert:
+    op.inserted = map.insert(op.key, op.value).get().second;
+    break;
+  case op_kind::erase:
+    op.erased = map.erase(op.key).get();
+    break;
+  case op_kind::get:
+    op.got = map.compute(op.key, [](const std::int64_t &v) { return v; })
+                 .get();
+    break;
+  case op_kind::merge:
+    op.merged = op.value;
+    map.merge(op.key, op.value,
+              [&op](const std::int64_t &value, const std::int64_t &old) {
+                return op.merged = sum(value, old);
+              })
+        .wait();
+    break;
+  }
+}
+
+template <class Map>
+static detached_task call_awaited(Map &map, operation &op) {
+  switch (op.kind) {
+  case op_kind::insert: {
+    auto result = co_await map.async_insert(op.key, op.value);
+    op.inserted = result.second;
+    break;
+  }
+  case op_kind::erase:
+    op.erased = co_await map.async_erase(op.key);
+    break;
+  case op_kind::get:
+    op.got = co_await map.async_compute(
+        op.key, [](const std::int64_t &v) { return v; });
+    break;
+  case op_kind::merge:
+    op.merged = op.value;
+    co_await map.async_merge(
+        op.key, op.value,
+        [&op](const std::int64_t &value, const std::int64_t &old) {
+          return op.merged = sum(value, old);
+        });
+    break;
+  }
+}
+
+static std::vector<operation> generate(const options &opt, std::uint64_t seed) {
+  std::mt19937_64 gen(seed);
+  std::uniform_int_distribution<int> key(0, opt.keys - 1);
+  std::uniform_int_distribution<int> kind(0, 99);
+  std::vector<operation> ops(opt.ops);
+  for (auto &op : ops) {
+    int k = kind(gen);
+    op.kind = k < 30   ? op_kind::insert
+              : k < 50 ? op_kind::erase
+              : k < 85 ? op_kind::get
+                       : op_kind::merge;
+    op.key = key(gen);
+    op.value = (std::int64_t)(gen() % 1000) + 1;
+  }
+  return ops;
+}
+
+template <class Probing>
+static bool run_round(const options &opt, std::size_t round) {
+  // a small table, so that resizes happen while other threads wait on it
+  chashmap<int, std::int64_t, Probing> map(16);
+  std::atomic<std::uint64_t> clock = 0;
+  std::vector<std::vector<operation>> histories;
+  for (std::size_t t = 0; t < opt.threads; ++t)
+    histories.push_back(generate(opt, opt.seed + round * 1000003 + t));
+
+  std::latch start_line(opt.threads + 1);
+  std::vector<std::thread> pool;
+  for (std::size_t t = 0; t < opt.threads; ++t) {
+    pool.emplace_back([&, t] {
+      start_line.arrive_and_wait();
+      for (auto &op : histories[t]) {
+        op.invoked = clock++;
+        if (opt.await)
+          call_awaited(map, op);
+        else
+          call(map, op);
+        op.returned = clock++;
+      }
+    });
+  }
+  auto start = std::chrono::steady_clock::now();
+  start_line.arrive_and_wait();
+  for (auto &thread : pool)
+    thread.join();
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  auto check_start = std::chrono::steady_clock::now();
+  std::vector<std::vector<const operation *>> by_key(opt.keys);
+  for (auto &history : histories)
+    for (auto &op : history)
+      by_key[op.key].push_back(&op);
+  std::optional<int> failed;
+  for (int key = 0; key < opt.keys && !failed; ++key)
+    if (!linearizable(by_key[key]))
+      failed = key;
+  double check_ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - check_start)
+                        .count();
+
+  std::size_t total = opt.threads * opt.ops;
+  std::cout << "| " << round << " | " << (opt.robin_hood ? "robin" : "linear")
+            << " | " << (opt.await ? "await" : "future") << " | "
+            << opt.threads << " | " << opt.keys << " | " << total << " | "
+            << std::fixed << std::setprecision(0) << total / seconds << " | "
+            << std::setprecision(1) << check_ms << " | "
+            << (failed ? "FAIL" : "ok") << " |" << std::endl;
+
+  if (failed) {
+    static const char *names[] = {"insert", "erase", "get", "merge"};
+    std::cout << "\nhistory of key " << *failed << ":\n";
+    for (auto *op : by_key[*failed]) {
+      std::cout << "[" << op->invoked << ", " << op->returned << "] "
+                << names[(int)op->kind] << "(" << op->value << ") -> ";
+      switch (op->kind) {
+      case op_kind::insert:
+        std::cout << op->inserted;
+        break;
+      case op_kind::erase:
+        std::cout << op->erased;
+        break;
+      case op_kind::get:
+        if (op->got)
+          std::cout << *op->got;
+        else
+          std::cout << "none";
+        break;
+      case op_kind::merge:
+        std::cout << op->merged;
+        break;
+      }
+      std::cout << "\n";
+    }
+  }
+  return !failed;
+}
+
+static options parse(int argc, char **argv) {
+  options opt;
+  for (int i = 1; i < argc; ++i) {
+    auto flag = [&](const char *name) {
+      if (std::strcmp(argv[i], name) != 0)
+        return false;
+      if (i + 1 == argc) {
+        std::cerr << name << " needs a value\n";
+        std::exit(2);
+      }
+      return true;
+    };
+    if (flag("--threads"))
+      opt.threads = std::stoul(argv[++i]);
+    else if (flag("--ops"))
+      opt.ops = std::stoul(argv[++i]);
+    else if (flag("--keys"))
+      opt.keys = std::stoi(argv[++i]);
+    else if (flag("--rounds"))
+      opt.rounds = std::stoul(argv[++i]);
+    else if (flag("--seed"))
+      opt.seed = std::stoull(argv[++i]);
+    else if (flag("--api"))
+      opt.await = std::string(argv[++i]) == "await";
+    else if (flag("--probing"))
+      opt.robin_hood = std::string(argv[++i]) == "robin";
+    else {
+      std::cerr << "unknown argument " << argv[i] << "\n";
+      std::exit(2);
+    }
+  }
+  if (opt.threads == 0 || opt.keys <= 0) {
+    std::cerr << "threads and keys need to be positive\n";
+    std::exit(2);
+  }
+  return opt;
+}
+
+int main(int argc, char **argv) {
+  options opt = parse(argc, argv);
+  std::cout << "| Round | Probing | API | Threads | Keys | Ops "
+               "| Throughput [ops/s] | Check [ms] | Result |\n"
+            << "|---:|:---|:---|---:|---:|---:|---:|---:|:---|" << std::endl;
+  for (std::size_t round = 0; round < opt.rounds; ++round) {
+    bool ok = opt.robin_hood ? run_round<robin_hood_probing>(opt, round)
+                             : run_round<linear_probing>(opt, round);
+    if (!ok)
+      return 1;
+  }
+  return 0;
+}
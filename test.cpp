@@ -6,12 +6,86 @@
 #include <thread>
 #include <unistd.h>
 #include <chrono>
+#include <coroutine>
+#include <deque>
+#include <functional>
+#include <mutex>
 
 #include "chashmap.h"
 
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch.hpp>
 
+// keys that count how often they get hashed
+template <bool cached> struct counted_key {
+  std::string value;
+  bool operator==(const counted_key &) const = default;
+};
+static std::atomic<int> hash_calls = 0;
+template <bool cached> struct std::hash<counted_key<cached>> {
+  std::size_t operator()(const counted_key<cached> &key) const {
+    ++hash_calls;
+    return std::hash<std::string>()(key.value);
+  }
+};
+template <> struct cache_hash<counted_key<false>> : std::false_type {};
+
+// keys whose hashes all collide under seed 0
+struct weak_key {
+  int value;
+  bool operator==(const weak_key &) const = default;
+};
+template <> struct std::hash<weak_key> {
+  std::size_t operator()(const weak_key &key) const { return key.value; }
+};
+template <> struct seeded_hash<weak_key> {
+  std::uint64_t operator()(const weak_key &key, std::uint64_t seed) const {
+    return seed == 0 ? 0 : seeded_hash<int>()(key.value, seed);
+  }
+};
+
+// keys whose std::hash is the same for every key
+struct constant_key {
+  int value;
+  bool operator==(const constant_key &) const = default;
+};
+template <> struct std::hash<constant_key> {
+  std::size_t operator()(const constant_key &) const { return 7; }
+};
+
+// keys that land in the bucket named by home, whatever the seed
+struct homed_key {
+  std::size_t home;
+  int value;
+  bool operator==(const homed_key &) const = default;
+};
+template <> struct std::hash<homed_key> {
+  std::size_t operator()(const homed_key &key) const { return key.home; }
+};
+template <> struct seeded_hash<homed_key> {
+  std::uint64_t operator()(const homed_key &key, std::uint64_t) const {
+    return key.home;
+  }
+};
+
+// an allocator that counts the arrays it allocates
+template <class T> struct counting_allocator {
+  using value_type = T;
+  std::size_t *count;
+  explicit counting_allocator(std::size_t &count) : count{&count} {}
+  template <class U>
+  counting_allocator(const counting_allocator<U> &other)
+      : count{other.count} {}
+  T *allocate(std::size_t n) {
+    ++*count;
+    return std::allocator<T>().allocate(n);
+  }
+  void deallocate(T *p, std::size_t n) { std::allocator<T>().deallocate(p, n); }
+  template <class U> bool operator==(const counting_allocator<U> &) const {
+    return true;
+  }
+};
+
 TEST_CASE("concurrent hash map") {
   chashmap<std::string, int> hashTable;
   {
@@ -110,7 +184,6 @@ TEST_CASE("concurrent hash map") {
                                  { "bar", 10000 },
                                  { "foobar", 10000 } });
     p1.wait();
-    // every now and then, some of these fails
     REQUIRE(hashTable["foobar"] == 10000); 
     REQUIRE(hashTable["bar"] == 10000);
     REQUIRE(hashTable["foo"] == 100);
@@ -172,17 +245,906 @@ TEST_CASE("concurrent hash map") {
   }
 }
 
-// TEST_CASE("mass insertions") {
-//   auto ht2 = chashmap<int, int, (int)1e6>(10000);
-//   for (int i = 0; i < 10000; ++i) {
-//     ht2.insert(i, i);
-//   }
+TEST_CASE("mass insertions") {
+  auto ht2 = chashmap<int, int>(10000);
+  std::vector<std::future<std::pair<chashmap<int, int>::iterator, bool>>>
+      pending;
+  for (int i = 0; i < 10000; ++i) {
+    pending.push_back(ht2.insert(i, i));
+    // every insertion runs on a thread of its own, keep a few hundred going
+    if (pending.size() == 256) {
+      for (auto &p : pending) {
+        p.wait();
+      }
+      pending.clear();
+    }
+  }
+  for (auto &p : pending) {
+    p.wait();
+  }
+  REQUIRE(ht2.size() == 10000);
+  for (int i = 0; i < 10000; ++i) {
+    REQUIRE(ht2[i] == i);
+  }
+}
+
+TEST_CASE("robin hood probing") {
+  chashmap<int, int, robin_hood_probing> hashTable;
+  for (int i = 0; i < 200; ++i) {
+    hashTable.insert(i * 7, i).wait();
+  }
+  REQUIRE(hashTable.size() == 200);
+  {
+    auto p = hashTable.insert(7, 100);
+    p.wait();
+    REQUIRE(p.get().second == false);
+  }
+  // erase every other key, the backward shift must keep the rest reachable
+  for (int i = 0; i < 200; i += 2) {
+    auto p = hashTable.erase(i * 7);
+    p.wait();
+    REQUIRE(p.get() == 1);
+  }
+  REQUIRE(hashTable.size() == 100);
+  for (int i = 0; i < 200; ++i) {
+    auto p = hashTable.get(i * 7);
+    p.wait();
+    auto value = p.get();
+    if (i % 2 == 0) {
+      REQUIRE(value == nullptr);
+    } else {
+      REQUIRE(value != nullptr);
+      REQUIRE(*value == i);
+    }
+  }
+  {
+    auto p = hashTable.erase_if([](const int &key) { return key % 3 == 0; });
+    p.wait();
+    REQUIRE(p.get() == 33);
+    auto q = hashTable.count_if([](const int &key) { return key % 3 == 0; });
+    q.wait();
+    REQUIRE(q.get() == 0);
+    REQUIRE(hashTable.size() == 67);
+  }
+  {
+    // a run from the last bucket wraps around to the first two. erasing its
+    // head shifts them back to the end, where they mustn't be tested again
+    chashmap<homed_key, int, robin_hood_probing> wrapped(16);
+    for (int i = 0; i < 3; ++i) {
+      wrapped.insert(homed_key{15, i}, i).wait();
+    }
+    int calls = 0;
+    auto p = wrapped.erase_if([&](const homed_key &key) {
+      ++calls;
+      return key.value == 0;
+    });
+    REQUIRE(p.get() == 1);
+    REQUIRE(calls == 3);
+    REQUIRE(wrapped.size() == 2);
+    for (int i = 1; i < 3; ++i) {
+      REQUIRE(wrapped.get(homed_key{15, i}).get() != nullptr);
+    }
+  }
+  {
+    auto p = hashTable.probe_stats();
+    p.wait();
+    auto stats = p.get();
+    REQUIRE(stats.max >= 1);
+    REQUIRE(stats.mean >= 1.0);
+    REQUIRE(stats.mean <= stats.max);
+  }
+  {
+    hashTable.max_load_factor(0.9);
+    REQUIRE(hashTable.max_load_factor() == Approx(0.9));
+    REQUIRE_THROWS(hashTable.max_load_factor(1.0));
+  }
+}
+
+TEST_CASE("bounded cache") {
+  chcache<int, int> cache(4);
+  REQUIRE(cache.capacity() == 4);
+  for (int i = 0; i < 4; ++i) {
+    cache.put(i, i * 10).wait();
+  }
+  REQUIRE(cache.size() == 4);
+  // reading 0 and 1 gives them a second chance
+  for (int i : {0, 1}) {
+    auto p = cache.get(i);
+    p.wait();
+    REQUIRE(p.get() == std::make_optional(i * 10));
+  }
+  cache.put(4, 40).wait();
+  REQUIRE(cache.size() == 4);
+  {
+    auto p = cache.get(2);
+    p.wait();
+    REQUIRE(p.get() == std::nullopt);
+  }
+  for (int i : {0, 1, 3, 4}) {
+    auto p = cache.get(i);
+    p.wait();
+    REQUIRE(p.get() == std::make_optional(i * 10));
+  }
+  {
+    auto p = cache.erase(4);
+    p.wait();
+    REQUIRE(p.get() == 1);
+    REQUIRE(cache.size() == 3);
+  }
+  for (int i = 100; i < 200; ++i) {
+    cache.put(i, i).wait();
+    REQUIRE(cache.size() <= 4);
+  }
+  REQUIRE(cache.stats().evictions > 0);
+
+  // large caches split into shards whose capacities add up to the total
+  chcache<int, int> sharded(5000);
+  REQUIRE(sharded.shard_count() == 4);
+  for (int i = 0; i < 20000; ++i) {
+    sharded.put(i, i).wait();
+  }
+  REQUIRE(sharded.size() == 5000);
+  auto p = sharded.get(19999);
+  REQUIRE(p.get() == std::make_optional(19999));
+
+  // size can be read while stores and evictions run
+  std::vector<std::future<void>> puts;
+  for (int i = 20000; i < 21000; ++i) {
+    puts.push_back(sharded.put(i, i));
+  }
+  for (int i = 0; i < 100; ++i) {
+    REQUIRE(sharded.size() <= 5000);
+  }
+  for (auto &put : puts) {
+    put.wait();
+  }
+  REQUIRE(sharded.size() == 5000);
+}
+
+TEST_CASE("cache expiry and coalesced loads") {
+  using namespace std::chrono_literals;
+  {
+    chcache<std::string, int> cache(8, 10ms);
+    cache.put("short lived", 1).wait();
+    std::this_thread::sleep_for(20ms);
+    auto p = cache.get("short lived");
+    p.wait();
+    REQUIRE(p.get() == std::nullopt);
+  }
+  {
+    chcache<std::string, int> cache(8);
+    std::atomic<int> calls = 0;
+    auto loader = [&](const std::string &key) {
+      std::this_thread::sleep_for(50ms);
+      ++calls;
+      return (int)key.size();
+    };
+    std::vector<std::future<int>> pool;
+    for (int i = 0; i < 8; ++i) {
+      pool.push_back(cache.get_or_load("backing store", loader));
+    }
+    for (auto &future : pool) {
+      REQUIRE(future.get() == 13);
+    }
+    REQUIRE(calls == 1);
+    REQUIRE(cache.stats().loads == 1);
+    auto p = cache.get_or_load("backing store", loader);
+    REQUIRE(p.get() == 13);
+    REQUIRE(calls == 1);
+  }
+}
+
+// runs to completion on its own, the test drives it through the scheduler
+struct detached_task {
+  struct promise_type {
+    detached_task get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+// jobs are scheduled by the thread that releases the table lock
+struct queue_scheduler {
+  std::mutex mutex;
+  std::deque<std::function<void()>> jobs;
+  void schedule(std::function<void()> job) {
+    std::lock_guard lock(mutex);
+    jobs.push_back(std::move(job));
+  }
+  std::size_t size() {
+    std::lock_guard lock(mutex);
+    return jobs.size();
+  }
+  // runs the oldest job, false if there is none
+  bool run_one() {
+    std::unique_lock lock(mutex);
+    if (jobs.empty())
+      return false;
+    auto job = std::move(jobs.front());
+    jobs.pop_front();
+    lock.unlock();
+    job();
+    return true;
+  }
+};
+
+TEST_CASE("awaitable operations") {
+  chashmap<std::string, int> hashTable;
+  {
+    int result = 0;
+    [&]() -> detached_task {
+      auto [iter, inserted] = co_await hashTable.async_insert("hello", 1);
+      REQUIRE(inserted);
+      int *value = co_await hashTable.async_get("hello");
+      REQUIRE(value != nullptr);
+      int &merged = co_await hashTable.async_merge(
+          "hello", 2, [](const int &left, const int &right) {
+            return left + right;
+          });
+      bool contained = co_await hashTable.async_contains("hello");
+      REQUIRE(contained);
+      result = merged;
+      auto erased = co_await hashTable.async_erase("hello");
+      REQUIRE(erased == 1);
+      contained = co_await hashTable.async_contains("hello");
+      REQUIRE_FALSE(contained);
+    }();
+    // nothing contended, so every co_await completed inline
+    REQUIRE(result == 3);
+  }
+  {
+    // hold the table lock from another thread so that awaiting has to
+    // suspend and retry through the scheduler
+    using namespace std::chrono_literals;
+    hashTable.insert("held", 0).wait();
+    std::atomic<bool> locked = false;
+    auto blocker = hashTable.erase_if([&](const std::string &) {
+      locked = true;
+      std::this_thread::sleep_for(100ms);
+      return false;
+    });
+    while (!locked)
+      std::this_thread::yield();
+
+    queue_scheduler scheduler;
+    bool done = false;
+    // the closure has to outlive the suspended coroutine
+    auto coroutine = [&]() -> detached_task {
+      co_await hashTable.async_insert_or_assign("world", 2, scheduler);
+      done = true;
+    };
+    coroutine();
+    REQUIRE_FALSE(done);
+    // parked on the lock, nothing retries while it is held
+    REQUIRE(scheduler.size() == 0);
+    // releasing the lock schedules the retry, before the blocker finishes
+    blocker.wait();
+    REQUIRE(scheduler.size() == 1);
+    while (scheduler.run_one())
+      ;
+    REQUIRE(done);
+    REQUIRE(hashTable["world"] == 2);
+  }
+}
+
+TEST_CASE("sharded map") {
+  REQUIRE(numa_topology::detect().node_count() >= 1);
+  auto topology = numa_topology::simulated(2);
+  REQUIRE(topology.node_count() == 2);
+  REQUIRE(topology.current_node() < 2);
+
+  // even keys belong on node 0, odd keys on node 1
+  chshardedmap<int, int> hashTable(
+      2, 16, [](const int &key) { return (std::size_t)key % 2; }, topology);
+  REQUIRE(hashTable.node_count() == 2);
+  REQUIRE(hashTable.shard_count() == 4);
+  for (int i = 0; i < 1000; ++i) {
+    hashTable.insert(i, i * 2).wait();
+    REQUIRE(hashTable.node_of_shard(hashTable.shard_index(i)) ==
+            (std::size_t)i % 2);
+  }
+  REQUIRE(hashTable.size() == 1000);
+  for (int i = 0; i < 1000; ++i) {
+    REQUIRE(hashTable[i] == i * 2);
+  }
+  {
+    auto p = hashTable.erase(10);
+    p.wait();
+    REQUIRE(p.get() == 1);
+    auto p1 = hashTable.contains(10);
+    p1.wait();
+    REQUIRE_FALSE(p1.get());
+  }
+  {
+    auto p = hashTable.merge(
+        11, 1, [](const int &left, const int &right) { return left + right; });
+    p.wait();
+    REQUIRE(p.get() == 23);
+  }
+  // every shard got its share of the keys, and grew on its node's thread
+  for (std::size_t shard = 0; shard < hashTable.shard_count(); ++shard) {
+    REQUIRE(hashTable.shard(shard).size() > 100);
+    REQUIRE(hashTable.shard(shard).bucket_count() > 16);
+  }
+  hashTable.clear();
+  REQUIRE(hashTable.size() == 0);
+
+  // every map routes keys with a seed of its own
+  chshardedmap<int, int> one(2, 16, {}, topology), other(2, 16, {}, topology);
+  bool routed_apart = false;
+  for (int i = 0; i < 64; ++i)
+    routed_apart |= one.shard_index(i) != other.shard_index(i);
+  REQUIRE(routed_apart);
+
+  // every bucket array, the first one included, comes from the allocator
+  std::size_t allocations = 0;
+  chashmap<int, int, linear_probing, 0, counting_allocator<std::byte>> placed(
+      16, counting_allocator<std::byte>(allocations));
+  for (int i = 0; i < 1000; ++i)
+    placed.insert(i, i).wait();
+  placed.reserve(10000);
+  // 16, doubled up to 2048, then reserved
+  REQUIRE(allocations == 9);
+  for (int i = 0; i < 1000; ++i)
+    REQUIRE(*placed.get(i).get() == i);
+}
+
+TEST_CASE("frozen map") {
+  chashmap<std::string, int> hashTable;
+  for (int i = 0; i < 500; ++i) {
+    hashTable.insert(std::to_string(i), i).wait();
+  }
+  hashTable.erase("42").wait();
+  auto p = hashTable.freeze();
+  p.wait();
+  const auto frozen = p.get();
+  REQUIRE(frozen.size() == 499);
+  for (int i = 0; i < 500; ++i) {
+    if (i == 42) {
+      REQUIRE_FALSE(frozen.contains("42"));
+      REQUIRE(frozen.get("42") == nullptr);
+      REQUIRE(frozen.find("42") == frozen.end());
+    } else {
+      REQUIRE(frozen.at(std::to_string(i)) == i);
+    }
+  }
+  REQUIRE_THROWS_AS(frozen.at("not in the frozen map"), std::out_of_range);
+  REQUIRE(frozen.count("7") == 1);
+  REQUIRE(std::distance(frozen.begin(), frozen.end()) == 499);
+  REQUIRE(frozen.memory_usage() > 0);
+
+  // the snapshot doesn't follow the live map
+  hashTable["7"] = 700;
+  REQUIRE(frozen.at("7") == 7);
+
+  auto thawed = frozen.thaw<robin_hood_probing>();
+  REQUIRE(thawed.size() == 499);
+  REQUIRE(thawed["7"] == 7);
+  thawed["42"] = 42;
+  REQUIRE(thawed.size() == 500);
+
+  chfrozenmap<int, int> nothing;
+  REQUIRE(nothing.empty());
+  REQUIRE_FALSE(nothing.contains(0));
+
+  // more keys share one home slot than a byte of distance counts
+  chashmap<constant_key, int> colliding;
+  for (int i = 0; i < 300; ++i)
+    colliding.insert({i}, i).wait();
+  const auto frozen_colliding = colliding.freeze().get();
+  REQUIRE(frozen_colliding.size() == 300);
+  for (int i = 0; i < 300; ++i)
+    REQUIRE(frozen_colliding.at({i}) == i);
+  REQUIRE_FALSE(frozen_colliding.contains({300}));
+}
+
+TEST_CASE("set and multimap") {
+  chashset<std::string, robin_hood_probing> set;
+  for (int i = 0; i < 100; ++i) {
+    set.insert(std::to_string(i % 50)).wait();
+  }
+  REQUIRE(set.size() == 50);
+  auto p = set.insert("7");
+  p.wait();
+  REQUIRE_FALSE(p.get().second);
+  REQUIRE(set.contains("7").get());
+  REQUIRE(set.count("50").get() == 0);
+  REQUIRE(*set.find("12").get() == "12");
+  REQUIRE(set.erase("12").get() == 1);
+  REQUIRE(set.find("12").get() == set.end());
+  REQUIRE(set.erase_if([](const std::string &key) { return key.size() == 1; })
+              .get() == 10);
+  REQUIRE(set.count_if([](const std::string &key) {
+                return key[0] == '4';
+              }).get() == 10);
+  int remaining = 0;
+  for (auto &key : set) {
+    REQUIRE(key.size() == 2);
+    remaining++;
+  }
+  REQUIRE(remaining == 39);
+
+  chmultimap<int, int> multimap;
+  std::vector<std::thread> pool;
+  for (int t = 0; t < 4; ++t) {
+    pool.emplace_back([&, t] {
+      for (int i = 0; i < 100; ++i) {
+        multimap.insert(i % 10, t * 100 + i).wait();
+      }
+    });
+  }
+  for (auto &thread : pool) {
+    thread.join();
+  }
+  REQUIRE(multimap.size() == 10);
+  for (int key = 0; key < 10; ++key) {
+    REQUIRE(multimap.count(key).get() == 40);
+    auto values = multimap.get(key).get();
+    REQUIRE(values.size() == 40);
+    REQUIRE(std::all_of(values.begin(), values.end(),
+                        [&](int value) { return value % 10 == key; }));
+  }
+  // one thread's values come back in the order it appended them
+  multimap.insert(10, 1).wait();
+  multimap.insert(10, 2).wait();
+  multimap.insert(10, 3).wait();
+  REQUIRE(multimap.get(10).get() == std::vector<int>{1, 2, 3});
+  REQUIRE(multimap.erase(10).get() == 3);
+  REQUIRE_FALSE(multimap.contains(10).get());
+  REQUIRE(multimap.get(10).get().empty());
+
+  // value lists can't be copied, so multimaps are move only
+  static_assert(!std::is_copy_constructible_v<chmultimap<int, int>>);
+  static_assert(!std::is_copy_assignable_v<chmultimap<int, int>>);
+  chmultimap<int, int> moved(std::move(multimap));
+  REQUIRE(moved.size() == 10);
+  REQUIRE(moved.count(3).get() == 40);
+}
+
+TEST_CASE("parallel construction and merge") {
+  std::vector<std::pair<int, int>> values;
+  for (int i = 0; i < 20000; ++i) {
+    values.emplace_back(i, i);
+  }
+  chashmap<int, int> left(values.begin(), values.end(), 4);
+  REQUIRE(left.size() == 20000);
+  REQUIRE(left.count_if([](int key, int value) { return key == value; })
+              .get() == 20000);
+
+  std::vector<std::pair<const int, int>> more;
+  for (int i = 10000; i < 30000; ++i) {
+    more.emplace_back(i, 1);
+  }
+  chashmap<int, int, robin_hood_probing> right(more.begin(), more.end(), 4);
+  chashmap<int, int, robin_hood_probing> other(more.begin(), more.end(), 3);
+  auto sum = [](const int &a, const int &b) { return a + b; };
+  right.merge_from(other, sum, 4).wait();
+  REQUIRE(right.size() == 20000);
+  REQUIRE(right.count_if([](int, int value) { return value == 2; }).get() ==
+          20000);
+
+  // tombstones in the target get reused
+  left.erase_if([](int key) { return key % 2 == 0; }).wait();
+  chashmap<int, int> evens;
+  for (int i = 0; i < 30000; i += 2) {
+    evens.insert(i, -1).wait();
+  }
+  left.merge_from(evens, sum, 4).wait();
+  REQUIRE(left.size() == 25000);
+  REQUIRE(*left.get(9999).get() == 9999);
+  REQUIRE(*left.get(9998).get() == -1);
+  REQUIRE(*left.get(29998).get() == -1);
+  REQUIRE_THROWS_AS(left.merge_from(left, sum).get(), std::runtime_error);
+
+  // copies don't share their entries
+  chashmap<int, int> copy = left;
+  copy[1] = 100;
+  copy.erase(3).wait();
+  REQUIRE(*left.get(1).get() == 1);
+  REQUIRE(left.contains(3).get());
+  REQUIRE(copy.size() == left.size() - 1);
+}
+
+TEST_CASE("hash caching") {
+  static_assert(cache_hash_v<std::string>);
+  static_assert(!cache_hash_v<int>);
+  static_assert(cache_hash_v<counted_key<true>>);
+  static_assert(!cache_hash_v<counted_key<false>>);
+
+  chashmap<counted_key<true>, int, robin_hood_probing> cached;
+  chashmap<counted_key<false>, int, robin_hood_probing> uncached;
+  for (int i = 0; i < 100; ++i) {
+    cached.insert({std::to_string(i)}, i).wait();
+    uncached.insert({std::to_string(i)}, i).wait();
+  }
+  // a resize doesn't hash any key again when the hashes are cached
+  hash_calls = 0;
+  cached.reserve(1000);
+  REQUIRE(hash_calls == 0);
+  REQUIRE(cached.bucket_count() > 1000);
+  uncached.reserve(1000);
+  REQUIRE(hash_calls >= 100);
+
+  hash_calls = 0;
+  REQUIRE(*cached.get({"42"}).get() == 42);
+  REQUIRE(hash_calls == 1);
+  cached.erase({"42"}).wait();
+  REQUIRE_FALSE(cached.contains({"42"}).get());
+  REQUIRE(cached.size() == 99);
+  auto frozen = cached.freeze().get();
+  auto thawed = frozen.thaw();
+  REQUIRE(*thawed.get({"7"}).get() == 7);
+}
+
+
+// whether p points into the storage of object
+template <class T> bool points_into(const void *p, const T &object) {
+  const auto *first = reinterpret_cast<const char *>(&object);
+  return std::less_equal<const void *>()(first, p) &&
+         std::less<const void *>()(p, first + sizeof(T));
+}
+
+TEST_CASE("small maps") {
+  chashmap<std::string, int, linear_probing, 4> small;
+  REQUIRE(small.bucket_count() == 8);
+  for (int i = 0; i < 4; ++i)
+    small.insert(std::to_string(i), i).wait();
+  int *zero = small.get("0").get();
+  REQUIRE(points_into(zero, small));
+
+  // a fifth entry lives on the heap, erased entries keep their slot as
+  // tombstones until the next resize
+  small.insert("4", 4).wait();
+  REQUIRE_FALSE(points_into(small.get("4").get(), small));
+  small.erase("1").wait();
+  small.insert("5", 5).wait();
+
+  // growing moves the buckets to the heap and leaves the entries in place
+  for (int i = 6; i < 100; ++i)
+    small.insert(std::to_string(i), i).wait();
+  REQUIRE(small.bucket_count() > 8);
+  REQUIRE(small.get("0").get() == zero);
+  REQUIRE(small.size() == 99);
+  for (int i = 0; i < 100; ++i)
+    REQUIRE(small.contains(std::to_string(i)).get() == (i != 1));
+
+  auto copy = small;
+  *copy.get("0").get() = 10;
+  REQUIRE(*small.get("0").get() == 0);
+
+  auto moved = std::move(small);
+  REQUIRE(points_into(moved.get("0").get(), moved));
+  REQUIRE(*moved.get("5").get() == 5);
+  REQUIRE(moved.size() == 99);
+  moved.clear();
+  moved.insert("a", 1).wait();
+  REQUIRE(points_into(moved.get("a").get(), moved));
+
+  // robin hood erasure frees the slot right away
+  chashmap<std::string, int, robin_hood_probing, 2> robin;
+  robin.insert("a", 1).wait();
+  robin.insert("b", 2).wait();
+  robin.erase("a").wait();
+  robin.insert("c", 3).wait();
+  REQUIRE(points_into(robin.get("c").get(), robin));
+  robin.clear();
+  for (int i = 0; i < 50; ++i)
+    robin.insert(std::to_string(i), i).wait();
+  for (int i = 0; i < 50; i += 2)
+    robin.erase(std::to_string(i)).wait();
+  REQUIRE(robin.size() == 25);
+  int count = 0;
+  for (auto &[key, value] : robin) {
+    REQUIRE(std::stoi(key) == value);
+    ++count;
+  }
+  REQUIRE(count == 25);
+}
+
+TEST_CASE("seeded hashing") {
+  static_assert(seeded_hash<std::string_view>()("key", 1) !=
+                seeded_hash<std::string_view>()("key", 2));
+  static_assert(seeded_hash<int>()(1, 1) != seeded_hash<int>()(2, 1));
+  for (std::size_t n = 0; n < 100; ++n) {
+    std::string s(n, 'x');
+    REQUIRE(seeded_hash<std::string>()(s, 3) ==
+            seeded_hash<std::string_view>()(s, 3));
+  }
+
+  // keys that all share a home bucket under std::hash, which is the identity
+  chashmap<std::uint64_t, int> patterned;
+  patterned.reserve(4000);
+  const std::uint64_t buckets = patterned.bucket_count();
+  for (std::uint64_t i = 0; i < 2000; ++i)
+    patterned.insert(i * buckets, 1).wait();
+  REQUIRE(patterned.bucket_count() == buckets);
+  REQUIRE(patterned.probe_stats().get().max < 64);
+
+  chashmap<weak_key, int> weak;
+  weak.reseed(0);
+  for (int i = 0; i < 200; ++i)
+    weak.insert({i}, i).wait();
+  REQUIRE(weak.probe_stats().get().max == 200);
+  weak.reseed();
+  REQUIRE(weak.probe_stats().get().max < 200);
+  for (int i = 0; i < 200; ++i)
+    REQUIRE(*weak.get({i}).get() == i);
+
+  // reseeds on its own once a probe runs too long
+  chashmap<weak_key, int, robin_hood_probing> guarded;
+  guarded.reseed(0);
+  guarded.max_probe_length(16);
+  for (int i = 0; i < 200; ++i)
+    guarded.insert({i}, i).wait();
+  REQUIRE(guarded.probe_stats().get().max < 64);
+  for (int i = 0; i < 200; ++i)
+    REQUIRE(*guarded.get({i}).get() == i);
+
+  // pointers hash by address, like they compare
+  char buffer[] = "key";
+  chashmap<char *, int> pointers;
+  pointers.insert(buffer, 1).wait();
+  pointers.insert(nullptr, 2).wait();
+  buffer[0] = 'K';
+  REQUIRE(*pointers.get(buffer).get() == 1);
+  REQUIRE(*pointers.get(nullptr).get() == 2);
+
+  // sets and multimaps move their key into the entry before a reseed
+  chashset<std::string> set;
+  chmultimap<std::string, int> multimap;
+  set.max_probe_length(1);
+  multimap.max_probe_length(1);
+  for (int i = 0; i < 2000; ++i) {
+    std::string key(40, 'k');
+    key += std::to_string(i);
+    set.insert(key).wait();
+    multimap.insert(key, i).wait();
+  }
+  REQUIRE(set.size() == 2000);
+  REQUIRE(multimap.size() == 2000);
+  for (int i = 0; i < 2000; ++i) {
+    std::string key(40, 'k');
+    key += std::to_string(i);
+    REQUIRE(set.contains(key).get());
+    REQUIRE(multimap.get(key).get() == std::vector<int>{i});
+  }
+}
+
+TEST_CASE("shrinking") {
+  // erasing frees the entry, the bucket keeps only a marker
+  chashmap<int, std::shared_ptr<int>> values;
+  std::vector<std::weak_ptr<int>> watched;
+  for (int i = 0; i < 1000; ++i) {
+    auto value = std::make_shared<int>(i);
+    watched.push_back(value);
+    values.insert(i, std::move(value)).wait();
+  }
+  const auto grown = values.bucket_count();
+  for (int i = 0; i < 990; ++i)
+    values.erase(i).wait();
+  REQUIRE(std::count_if(watched.begin(), watched.end(), [](auto &w) {
+            return w.expired();
+          }) == 990);
+  REQUIRE(values.bucket_count() == grown);
+  {
+    auto copy = values;
+    REQUIRE(**copy.get(995).get() == 995);
+    copy.erase(995).wait();
+    REQUIRE_FALSE(copy.contains(995).get());
+    REQUIRE(values.contains(995).get());
+  }
 
-//   using namespace std::chrono_literals;
+  // a multimap frees the whole list of values of the first key it erases
+  chmultimap<int, std::shared_ptr<int>> lists;
+  auto listed = std::make_shared<int>(0);
+  lists.insert(0, listed).wait();
+  lists.insert(0, listed).wait();
+  lists.insert(1, listed).wait();
+  REQUIRE(lists.erase(0).get() == 2);
+  REQUIRE(listed.use_count() == 2);
 
-//   std::this_thread::sleep_for(1s);
-//   REQUIRE(ht2.size() == 10000);
-//   for (int i = 0; i < 10000; ++i) {
-//     REQUIRE(ht2[i] == i);
-//   }
-// }
\ No newline at end of file
+  values.shrink_to_fit();
+  REQUIRE(values.bucket_count() < 20);
+  REQUIRE(std::all_of(watched.begin(), watched.end() - 10,
+                      [](auto &w) { return w.expired(); }));
+  for (int i = 990; i < 1000; ++i)
+    REQUIRE(**values.get(i).get() == i);
+
+  REQUIRE_THROWS(values.min_load_factor(0.5));
+  chashmap<int, int, robin_hood_probing> shrinking;
+  shrinking.min_load_factor(0.125);
+  for (int i = 0; i < 10000; ++i)
+    shrinking.insert(i, i).wait();
+  for (int i = 0; i < 9990; ++i)
+    shrinking.erase(i).wait();
+  REQUIRE(shrinking.bucket_count() < 100);
+  for (int i = 9990; i < 10000; ++i)
+    REQUIRE(*shrinking.get(i).get() == i);
+  REQUIRE_THROWS(shrinking.max_load_factor(0.2));
+
+  shrinking.clear();
+  REQUIRE(shrinking.bucket_count() > 16);
+  shrinking.insert(1, 1).wait();
+  shrinking.clear(true);
+  REQUIRE(shrinking.bucket_count() == 16);
+  REQUIRE(shrinking.size() == 0);
+
+  // the tombstone of a small map can live inline and moves with the map
+  chashmap<std::string, int, linear_probing, 4> small;
+  for (int i = 0; i < 4; ++i)
+    small.insert(std::to_string(i), i).wait();
+  small.erase("0").wait();
+  small.erase("1").wait();
+  auto moved = std::move(small);
+  REQUIRE_FALSE(moved.contains("0").get());
+  REQUIRE(*moved.get("3").get() == 3);
+  moved.insert("4", 4).wait();
+  moved.shrink_to_fit();
+  REQUIRE(moved.bucket_count() == 8);
+  REQUIRE(moved.size() == 3);
+}
+
+TEST_CASE("change log") {
+  chashmap<std::string, int> source;
+  source.insert("before", 0).wait();
+  auto log = source.enable_change_log(8);
+  REQUIRE(log->capacity() == 8);
+  // a replica copied after enabling the log, which the copy doesn't share
+  auto replica = source;
+  source.insert("a", 1).wait();
+  source.insert("a", 9).wait();
+  source.insert_or_assign("a", 2).wait();
+  source.merge("b", 3, [](int x, int y) { return x + y; }).wait();
+  source.erase("before").wait();
+  source.erase("missing").wait();
+  replica.insert("unrelated", 7).wait();
+
+  using change = chchangelog<std::string, int>::change;
+  std::vector<change> changes;
+  REQUIRE(log->drain(changes, 2) == 2);
+  REQUIRE(log->drain(changes) == 2);
+  REQUIRE(log->drain(changes) == 0);
+  REQUIRE(changes.size() == 4);
+  REQUIRE(changes[0].kind == change_kind::insert);
+  REQUIRE(changes[0].key == "a");
+  REQUIRE(changes[0].value == 1);
+  REQUIRE(changes[1].kind == change_kind::assign);
+  REQUIRE(changes[1].value == 2);
+  REQUIRE(changes[2].kind == change_kind::insert);
+  REQUIRE(changes[2].key == "b");
+  REQUIRE(changes[3].kind == change_kind::erase);
+  REQUIRE(changes[3].key == "before");
+  REQUIRE_FALSE(changes[3].value);
+
+  for (auto &c : changes) {
+    if (c.kind == change_kind::erase)
+      replica.erase(*c.key).wait();
+    else
+      replica.insert_or_assign(*c.key, *c.value).wait();
+  }
+  replica.erase("unrelated").wait();
+  REQUIRE(replica.size() == source.size());
+  REQUIRE(source.count_if([&](const std::string &key, const int &value) {
+    auto theirs = replica.get(key).get();
+    return theirs != nullptr && *theirs == value;
+  }).get() == source.size());
+
+  source.erase_if([](const std::string &key) { return key == "a"; }).wait();
+  source.erase(source.begin());
+  source.clear();
+  changes.clear();
+  log->drain(changes);
+  REQUIRE(changes.size() == 3);
+  REQUIRE(changes[0].key == "a");
+  REQUIRE(changes[1].key == "b");
+  REQUIRE(changes[2].kind == change_kind::clear);
+  REQUIRE_FALSE(changes[2].key);
+
+  source.disable_change_log();
+  source.insert("c", 4).wait();
+  REQUIRE(log->drain(changes) == 0);
+  REQUIRE_THROWS(source.enable_change_log(0));
+
+  // with drop, a full log loses the newest changes and counts them
+  chashmap<int, int> dropping;
+  auto lossy = dropping.enable_change_log(4, backpressure::drop);
+  for (int i = 0; i < 10; ++i)
+    dropping.insert(i, i).wait();
+  std::vector<chchangelog<int, int>::change> kept;
+  REQUIRE(lossy->drain(kept) == 4);
+  REQUIRE(lossy->dropped() == 6);
+  REQUIRE(kept.back().key == 3);
+
+  // with block, writers wait for the consumer instead
+  chashmap<int, int> blocking;
+  auto lossless = blocking.enable_change_log(4);
+  std::vector<std::thread> writers;
+  for (int t = 0; t < 4; ++t)
+    writers.emplace_back([&, t] {
+      for (int i = 0; i < 250; ++i)
+        blocking.insert(t * 250 + i, i).wait();
+    });
+  std::vector<chchangelog<int, int>::change> all;
+  while (all.size() < 1000)
+    if (lossless->drain(all, 3) == 0)
+      std::this_thread::yield();
+  for (auto &writer : writers)
+    writer.join();
+  REQUIRE(lossless->dropped() == 0);
+  std::sort(all.begin(), all.end(),
+            [](auto &x, auto &y) { return *x.key < *y.key; });
+  for (int i = 0; i < 1000; ++i)
+    REQUIRE(*all[i].key == i);
+
+  // a writer waits for room without holding the table lock, so a consumer
+  // can use the map while the log is full
+  chashmap<int, int> full;
+  auto ring = full.enable_change_log(1);
+  REQUIRE(ring->capacity() == 2);
+  full.insert(1, 1).wait();
+  full.insert(2, 2).wait();
+  auto waiting = full.insert(3, 3);
+  while (!full.contains(3).get())
+    std::this_thread::yield();
+  REQUIRE(waiting.wait_for(std::chrono::seconds(0)) ==
+          std::future_status::timeout);
+  std::vector<chchangelog<int, int>::change> first;
+  REQUIRE(ring->drain(first, 1) == 1);
+  waiting.wait();
+  REQUIRE(ring->drain(first) == 2);
+  for (int i = 0; i < 3; ++i)
+    REQUIRE(*first[i].key == i + 1);
+
+  // a sharded map has a log per shard
+  chshardedmap<int, int> sharded(4, 16, {}, numa_topology::simulated(2));
+  auto logs = sharded.enable_change_log(64);
+  REQUIRE(logs.size() == sharded.shard_count());
+  for (int i = 0; i < 40; ++i)
+    sharded.insert(i, i).wait();
+  std::size_t drained = 0;
+  for (std::size_t shard = 0; shard < logs.size(); ++shard) {
+    std::vector<chchangelog<int, int>::change> batch;
+    drained += logs[shard]->drain(batch);
+    for (auto &c : batch)
+      REQUIRE(sharded.shard_index(*c.key) == shard);
+  }
+  REQUIRE(drained == 40);
+}
+
+TEST_CASE("static map") {
+  static constexpr chstaticmap<std::string_view, int, 4> codes({
+      {"ok", 200},
+      {"not found", 404},
+      {"teapot", 418},
+      {"unavailable", 503},
+  });
+  // everything runs at compile time
+  static_assert(codes.at("teapot") == 418);
+  static_assert(codes.contains("ok"));
+  static_assert(!codes.contains("moved"));
+  static_assert(codes.size() == 4 && codes.bucket_count() == 8);
+
+  REQUIRE(*codes.get(std::string("not found")) == 404);
+  REQUIRE(codes.get("moved") == nullptr);
+  REQUIRE(codes.count("unavailable") == 1);
+  REQUIRE_THROWS_AS(codes.at("moved"), std::out_of_range);
+  REQUIRE(codes.find("ok")->second == 200);
+  int sum = 0;
+  for (auto &[key, value] : codes)
+    sum += value;
+  REQUIRE(sum == 200 + 404 + 418 + 503);
+
+  constexpr auto squares = []<int... I>(std::integer_sequence<int, I...>) {
+    return chstaticmap<int, int, sizeof...(I)>({{I * 1000, I * I}...});
+  }(std::make_integer_sequence<int, 100>());
+  static_assert(squares.at(42000) == 42 * 42);
+  for (int i = 0; i < 100; ++i)
+    REQUIRE(squares.at(i * 1000) == i * i);
+  REQUIRE_FALSE(squares.contains(1));
+
+  // a duplicate key fails the build in a constant expression, and throws
+  // at run time
+  REQUIRE_THROWS((chstaticmap<int, int, 2>({{1, 1}, {1, 2}})));
+}